@@ -9,426 +9,3182 @@
 #ifndef _AVL__H
 #define _AVL__H
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
 #define _MAX(X, Y) ((X) > (Y) ? (X) : (Y))
 
-template <class T>
-class AvlTree;
+/**
+ * define AVL_TELEMETRY before including this file to count tree operations,
+ * otherwise all the instrumentation is compiled out.
+ * The counters are plain members updated by const lookups as well, so with AVL_TELEMETRY
+ * even concurrent const lookups of a single tree need external synchronization
+ */
+#ifdef AVL_TELEMETRY
+#include <chrono>
+#define _AVL_TELEMETRY(...) __VA_ARGS__
+#else
+#define _AVL_TELEMETRY(...)
+#endif
+
+#ifdef AVL_TELEMETRY
+/**
+ * @brief operation counters and latency histograms of a single tree
+ * @note latency histogram bucket i counts operations that took less than 2^i nanoseconds (and at least 2^(i-1)),
+ *  the last bucket also counts anything slower.
+ *  The counters are not atomic, a tree shared between threads must not run lookups concurrently, const or not
+ */
+struct AvlTelemetry
+{
+  typedef unsigned long long counter;
+
+  enum op
+  {
+    op_lookup,
+    op_insert,
+    op_remove,
+    _OP_COUNT,
+  };
+
+  static const int latency_buckets = 32;
+
+  counter operations[_OP_COUNT];
+  counter comparisons[_OP_COUNT];
+  counter rotations_left[_OP_COUNT];
+  counter rotations_right[_OP_COUNT];
+  counter allocations;
+  counter frees;
+  counter retrace_levels;
+  counter max_retrace_depth;
+  counter latency_ns_sum[_OP_COUNT];
+  counter latency[_OP_COUNT][latency_buckets];
+
+  AvlTelemetry()
+  {
+    reset();
+  }
+
+  void reset()
+  {
+    *this = AvlTelemetry(0);
+  }
+
+  static const char *op_name(int op)
+  {
+    static const char *names[_OP_COUNT] = {"lookup", "insert", "remove"};
+    return names[op];
+  }
+
+  /**
+   * @brief measures a single operation for as long as it is in scope
+   */
+  class scope
+  {
+  public:
+    scope(AvlTelemetry &telemetry, op operation)
+        : telemetry_(telemetry),
+          op_(operation),
+          retrace_levels_(telemetry.retrace_levels),
+          start_(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~scope()
+    {
+      const counter ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+      int bucket = 0;
+      while (bucket < latency_buckets - 1 && (counter(1) << bucket) <= ns)
+      {
+        bucket++;
+      }
+      telemetry_.operations[op_]++;
+      telemetry_.latency_ns_sum[op_] += ns;
+      telemetry_.latency[op_][bucket]++;
+      telemetry_.max_retrace_depth = _MAX(telemetry_.max_retrace_depth, telemetry_.retrace_levels - retrace_levels_);
+    }
+
+  private:
+    AvlTelemetry &telemetry_;
+    op op_;
+    counter retrace_levels_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+private:
+  explicit AvlTelemetry(int) : operations(), comparisons(), rotations_left(), rotations_right(), allocations(0), frees(0), retrace_levels(0), max_retrace_depth(0), latency_ns_sum(), latency()
+  {
+  }
+};
+#endif // AVL_TELEMETRY
 
-template <class T>
-class AvlNode
+namespace avl
 {
-  friend class AvlTree<T>;
+  /**
+   * @brief default augmentation policy, nodes keep no aggregate
+   *
+   * an augmentation policy keeps a subtree aggregate per node, it should provide:
+   *  typedef ... value_type;
+   *  static value_type identity();
+   *  static value_type lift(const Key &key, const T &data);
+   *  static value_type combine(const value_type &left, const value_type &right);
+   *
+   * combine must be associative, it is not required to be commutative since aggregates are combined in key order
+   */
+  struct no_augment
+  {
+    struct value_type
+    {
+    };
+  };
 
-public:
-  T data;
+  /**
+   * @brief sum of data over subtrees
+   */
+  template <class T>
+  struct sum_augment
+  {
+    typedef T value_type;
+    static value_type identity() { return value_type(); }
+    template <class Key>
+    static value_type lift(const Key &, const T &data) { return data; }
+    static value_type combine(const value_type &left, const value_type &right) { return left + right; }
+  };
 
-  AvlNode(int key, const T &data, AvlNode<T> *parent)
-      : data(data),
-        key_(key),
-        parent_(parent),
-        left_(NULL),
-        right_(NULL),
-        height_(1)
+  /**
+   * @brief minimum of data over subtrees
+   */
+  template <class T>
+  struct min_augment
+  {
+    typedef T value_type;
+    static value_type identity() { return std::numeric_limits<T>::max(); }
+    template <class Key>
+    static value_type lift(const Key &, const T &data) { return data; }
+    static value_type combine(const value_type &left, const value_type &right) { return right < left ? right : left; }
+  };
+
+  /**
+   * @brief maximum of data over subtrees
+   */
+  template <class T>
+  struct max_augment
+  {
+    typedef T value_type;
+    static value_type identity() { return std::numeric_limits<T>::lowest(); }
+    template <class Key>
+    static value_type lift(const Key &, const T &data) { return data; }
+    static value_type combine(const value_type &left, const value_type &right) { return left < right ? right : left; }
+  };
+
+  /**
+   * @brief Merkle style hash of the keys and data over subtrees, for replica comparison and diff
+   *
+   * the aggregate is a polynomial hash of the key ordered sequence, sum of h(i) * B^(n-1-i) modulo 2^64, kept with B^n so
+   * it combines associatively. It depends on the content only, never on the tree shape, so equal ranges of two trees hash
+   * the same even when they were built in a different order or with a different balancing policy.
+   * It uses std::hash of the key and data, it is not a cryptographic hash
+   */
+  template <class T, class Hash = std::hash<T>>
+  struct hash_augment
+  {
+    struct value_type
+    {
+      uint64_t hash;
+      uint64_t power;
+
+      bool operator==(const value_type &other) const
+      {
+        return hash == other.hash && power == other.power;
+      }
+
+      bool operator!=(const value_type &other) const
+      {
+        return !(*this == other);
+      }
+    };
+
+    static const uint64_t base = 0x9e3779b97f4a7c15ULL;
+
+    static value_type identity()
+    {
+      const value_type empty = {0, 1};
+      return empty;
+    }
+
+    template <class Key>
+    static value_type lift(const Key &key, const T &data)
+    {
+      const value_type single = {mix(mix(std::hash<Key>()(key)) ^ Hash()(data)), base};
+      return single;
+    }
+
+    static value_type combine(const value_type &left, const value_type &right)
+    {
+      const value_type both = {left.hash * right.power + right.hash, left.power * right.power};
+      return both;
+    }
+
+  private:
+    /**
+     * @brief splitmix64 finalizer, std::hash of integers is often the identity
+     */
+    static uint64_t mix(uint64_t x)
+    {
+      x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+      return x ^ (x >> 31);
+    }
+  };
+
+  /**
+   * @brief node order inside the contiguous block of a clone
+   */
+  enum clone_layout
+  {
+    inorder_layout, // ascending keys, range scans read memory sequentially
+    veb_layout,     // van Emde Boas, every subtree of half the height is contiguous, so lookups touch fewer cache lines
+  };
+
+  /**
+   * @brief tag of the node copy placed in a clone block
+   */
+  struct _pooled
+  {
+  };
+
+  /**
+   * @brief node block of a copy, shared by the trees and the handles holding its nodes, freed with its last owner
+   *
+   * a node taken out of the block by a handle leaves a hole, freed with the rest of the block
+   */
+  struct _node_block
+  {
+    void *memory;
+    size_t bytes;
+    std::atomic<size_t> owners;
+
+    explicit _node_block(size_t bytes) : memory(::operator new(bytes)), bytes(bytes), owners(1) {}
+
+    ~_node_block()
+    {
+      ::operator delete(memory);
+    }
+
+    bool holds(const void *node) const
+    {
+      const std::less<const void *> before;
+      return !before(node, memory) && before(node, static_cast<const char *>(memory) + bytes);
+    }
+
+    void acquire()
+    {
+      owners++;
+    }
+
+    void release()
+    {
+      if (!--owners)
+      {
+        delete this;
+      }
+    }
+  };
+
+  /**
+   * @brief three-way key comparison, requires operator< only
+   *
+   * @return int negative, zero or positive when a is less than, equal to or greater than b
+   */
+  template <class Key, bool Integral = std::is_integral<Key>::value>
+  struct _key_compare
+  {
+    static int compare(const Key &a, const Key &b)
+    {
+      return a < b ? -1 : (b < a ? 1 : 0);
+    }
+  };
+
+  /**
+   * @brief branchless three-way comparison of integral keys,
+   *  descending to child_[compare(key, node->key_) > 0] takes no unpredictable branch
+   */
+  template <class Key>
+  struct _key_compare<Key, true>
+  {
+    static int compare(Key a, Key b)
+    {
+      return int(a > b) - int(a < b);
+    }
+  };
+
+  /**
+   * @brief per node aggregate storage, empty for no_augment so non augmented nodes pay nothing
+   */
+  template <class Augment>
+  struct _augment_slot
+  {
+    typename Augment::value_type aggregate_;
+
+    template <class Node>
+    static typename Augment::value_type aggregate_of(const Node *node)
+    {
+      return node ? node->aggregate_ : Augment::identity();
+    }
+
+    /**
+     * @brief the node own contribution, a tombstone contributes nothing
+     */
+    template <class Node>
+    static typename Augment::value_type lift_of(const Node *node)
+    {
+      return node->tombstone_ ? Augment::identity() : Augment::lift(node->key_, node->data);
+    }
+
+    template <class Node>
+    void update_aggregate(const Node *node)
+    {
+      aggregate_ = Augment::combine(Augment::combine(aggregate_of(node->child_[0]), lift_of(node)), aggregate_of(node->child_[1]));
+    }
+  };
+
+  template <>
+  struct _augment_slot<no_augment>
+  {
+    template <class Node>
+    void update_aggregate(const Node *)
+    {
+    }
+  };
+
+  /**
+   * @brief node policy keeping every node linked to its inorder neighbors, on top of an augmentation policy
+   *
+   * next() and previous() then take a single pointer load instead of climbing the tree, at the cost of two pointers per node,
+   * for example AvlTree<T, Key, avl::threaded<>> or AvlTree<T, Key, avl::threaded<avl::sum_augment<T>>>
+   */
+  template <class Augment = no_augment>
+  struct threaded : Augment
+  {
+  };
+
+  /**
+   * @brief the augmentation policy under an optional threaded wrapper, and whether nodes are threaded
+   */
+  template <class Augment>
+  struct _threading
+  {
+    typedef Augment augment;
+    typedef std::false_type threaded;
+  };
+
+  template <class Augment>
+  struct _threading<threaded<Augment>>
+  {
+    typedef Augment augment;
+    typedef std::true_type threaded;
+  };
+
+  template <class Augment>
+  struct _augment_slot<threaded<Augment>> : _augment_slot<Augment>
+  {
+  };
+
+  /**
+   * @brief per node inorder links, empty for trees that are not threaded so their nodes pay nothing
+   *
+   * the tree calls the same link maintenance on every node type, it does nothing here
+   */
+  template <class Node, bool Threaded>
+  struct _thread_slot
+  {
+    static void thread(Node *)
+    {
+    }
+
+    static void thread(Node *, Node *, Node *)
+    {
+    }
+
+    static void splice(Node *, Node *, int)
+    {
+    }
+
+    static void unsplice(Node *, Node *)
+    {
+    }
+
+    static void relink(Node *, Node *)
+    {
+    }
+  };
+
+  template <class Node>
+  struct _thread_slot<Node, true>
+  {
+    // inorder predecessor and successor, tombstones included
+    Node *link_[2];
+
+    _thread_slot() : link_() {}
+
+    /**
+     * @brief link the inorder neighbors of every node in the subtree, leaving its first and last nodes unlinked outward
+     */
+    static void thread(Node *root)
+    {
+      Node *last = NULL;
+      thread(root, last);
+      if (last)
+      {
+        last->link_[1] = NULL;
+      }
+    }
+
+    /**
+     * @brief set the neighbors of a node placed in a sorted block
+     */
+    static void thread(Node *node, Node *before, Node *after)
+    {
+      node->link_[0] = before;
+      node->link_[1] = after;
+    }
+
+    /**
+     * @brief link a new leaf next to its parent, which is its inorder neighbor on the opposite side
+     */
+    static void splice(Node *node, Node *parent, int dir)
+    {
+      node->link_[!dir] = parent;
+      node->link_[dir] = parent->link_[dir];
+      parent->link_[dir] = node;
+      if (node->link_[dir])
+      {
+        node->link_[dir]->link_[!dir] = node;
+      }
+    }
+
+    /**
+     * @brief unlink the inorder run [first, last] from its neighbors
+     */
+    static void unsplice(Node *first, Node *last)
+    {
+      if (first->link_[0])
+      {
+        first->link_[0]->link_[1] = last->link_[1];
+      }
+      if (last->link_[1])
+      {
+        last->link_[1]->link_[0] = first->link_[0];
+      }
+      first->link_[0] = last->link_[1] = NULL;
+    }
+
+    /**
+     * @brief hand the neighbors of a node over to its moved copy
+     */
+    static void relink(Node *node, Node *moved)
+    {
+      for (int dir = 0; dir < 2; dir++)
+      {
+        moved->link_[dir] = node->link_[dir];
+        if (moved->link_[dir])
+        {
+          moved->link_[dir]->link_[!dir] = moved;
+        }
+      }
+    }
+
+  private:
+    static void thread(Node *node, Node *&last)
+    {
+      if (!node)
+      {
+        return;
+      }
+      thread(node->child_[0], last);
+      node->link_[0] = last;
+      if (last)
+      {
+        last->link_[1] = node;
+      }
+      last = node;
+      thread(node->child_[1], last);
+    }
+  };
+
+  /**
+   * @brief AVL balancing, subtree heights of siblings differ by one at most
+   *
+   * a balancing policy restores its invariant after the tree linked or unlinked a node, it should provide:
+   *  template <class Tree, class Node> static void inserted(Tree &tree, Node *node);
+   *   node was linked as a new leaf
+   *  template <class Tree, class Node> static void removed(Tree &tree, Node *parent, int dir, unsigned char removed_rank);
+   *   parent->child_[dir] lost a node, removed_rank is the rank of the node taken out of that position
+   *  template <class Tree, class Node> static void rebuilt(Tree &tree, Node *root);
+   *   the subtree was rebuilt perfectly balanced
+   *  static const bool joins;
+   *   whether the tree may split and join subtrees by height, then it should also provide
+   *  template <class Tree, class Node> static void joined(Tree &tree, Node *node);
+   *   node was linked in place of a subtree one or two levels lower
+   *
+   * the tree keeps heights and aggregates, the policy may keep its own state in the node rank
+   */
+  struct avl_balance
+  {
+    static const bool joins = true;
+
+    template <class Tree, class Node>
+    static void inserted(Tree &tree, Node *node)
+    {
+      retrace(tree, Tree::parent(node));
+    }
+
+    template <class Tree, class Node>
+    static void joined(Tree &tree, Node *node)
+    {
+      retrace(tree, Tree::parent(node));
+    }
+
+    template <class Tree, class Node>
+    static void removed(Tree &tree, Node *parent, int, unsigned char)
+    {
+      retrace(tree, parent);
+    }
+
+    template <class Tree, class Node>
+    static void rebuilt(Tree &, Node *)
+    {
+    }
+
+  private:
+    /**
+     * @brief update heights on the way back to the root, rotating any node whose children heights differ by two
+     * @note a maximum of O(log n) retracing levels, with up to two rotations per insert and O(log n) rotations per remove
+     */
+    template <class Tree, class Node>
+    static void retrace(Tree &tree, Node *node)
+    {
+      for (; node; node = Tree::parent(node))
+      {
+        tree.retrace(node);
+
+        const int balance = node->balance();
+
+        if (balance > 1)
+        {
+          Node *left = Tree::child(node, 0);
+          if (left->balance() < 0)
+          {
+            left = tree.rotate_up(Tree::child(left, 1));
+          }
+          node = tree.rotate_up(left);
+        }
+
+        if (balance < -1)
+        {
+          Node *right = Tree::child(node, 1);
+          if (right->balance() > 0)
+          {
+            right = tree.rotate_up(Tree::child(right, 0));
+          }
+          node = tree.rotate_up(right);
+        }
+      }
+    }
+  };
+
+  /**
+   * @brief weak AVL balancing (Haeupler, Sen and Tarjan, "Rank-Balanced Trees")
+   *
+   * every node has a rank, a missing node has rank -1, rank differences are 1 or 2 and leaves have rank 0.
+   * insert rebalances exactly like AVL, while remove takes at most two rotations, so delete heavy streams rotate less,
+   * the height is still bounded by 2 log n
+   */
+  struct wavl_balance
   {
+    static const bool joins = false;
+
+    template <class Tree, class Node>
+    static void inserted(Tree &tree, Node *node)
+    {
+      tree.refresh(Tree::parent(node));
+      Tree::rank(node) = 0;
+
+      // node is a 0-child of parent
+      for (Node *x = node, *parent = Tree::parent(x); parent && rank(parent) == rank(x); parent = Tree::parent(x))
+      {
+        const int dir = Tree::child(parent, 1) == x;
+        if (rank(parent) - rank(Tree::child(parent, !dir)) == 1)
+        {
+          Tree::rank(parent)++;
+          x = parent;
+          continue;
+        }
+
+        Node *inner = Tree::child(x, !dir);
+        if (!inner || rank(x) - rank(inner) == 2)
+        {
+          tree.rotate_up(x);
+          Tree::rank(parent)--;
+        }
+        else
+        {
+          tree.rotate_up(inner);
+          tree.rotate_up(inner);
+          Tree::rank(inner)++;
+          Tree::rank(x)--;
+          Tree::rank(parent)--;
+        }
+        break;
+      }
+
+      tree.refresh(node);
+    }
+
+    template <class Tree, class Node>
+    static void removed(Tree &tree, Node *parent, int dir, unsigned char)
+    {
+      tree.refresh(parent);
+
+      Node *x = parent ? Tree::child(parent, dir) : NULL;
+      Node *p = parent;
+      if (p && !Tree::child(p, 0) && !Tree::child(p, 1) && rank(p) == 1)
+      {
+        // 2,2 leaf
+        Tree::rank(p)--;
+        x = p;
+        p = Tree::parent(p);
+      }
+
+      // x is a 3-child of p
+      while (p && rank(p) - rank(x) == 3)
+      {
+        const int side = x ? Tree::child(p, 1) == x : dir;
+        Node *sibling = Tree::child(p, !side);
+        if (rank(p) - rank(sibling) == 2)
+        {
+          Tree::rank(p)--;
+          x = p;
+          p = Tree::parent(p);
+          continue;
+        }
+
+        Node *inner = Tree::child(sibling, side);
+        Node *outer = Tree::child(sibling, !side);
+        if (rank(sibling) - rank(inner) == 2 && rank(sibling) - rank(outer) == 2)
+        {
+          Tree::rank(p)--;
+          Tree::rank(sibling)--;
+          x = p;
+          p = Tree::parent(p);
+          continue;
+        }
+
+        if (rank(sibling) - rank(outer) == 1)
+        {
+          tree.rotate_up(sibling);
+          Tree::rank(sibling)++;
+          Tree::rank(p)--;
+          if (!Tree::child(p, 0) && !Tree::child(p, 1))
+          {
+            Tree::rank(p)--;
+          }
+        }
+        else
+        {
+          tree.rotate_up(inner);
+          tree.rotate_up(inner);
+          Tree::rank(inner) += 2;
+          Tree::rank(sibling)--;
+          Tree::rank(p) -= 2;
+        }
+        break;
+      }
+
+      tree.refresh(parent);
+    }
+
+    /**
+     * @brief every AVL tree is a weak AVL tree ranked by height
+     */
+    template <class Tree, class Node>
+    static void rebuilt(Tree &tree, Node *node)
+    {
+      if (node)
+      {
+        Tree::rank(node) = node->height() - 1;
+        rebuilt(tree, Tree::child(node, 0));
+        rebuilt(tree, Tree::child(node, 1));
+      }
+    }
+
+  private:
+    template <class Node>
+    static int rank(const Node *node)
+    {
+      return node ? node->rank() : -1;
+    }
+  };
+
+  /**
+   * @brief red-black balancing (Cormen, Leiserson, Rivest and Stein, "Introduction to Algorithms")
+   *
+   * the node rank is its color, 1 for red and 0 for black, every path from a node down to a missing node has the same number of black nodes
+   * and a red node has no red child. Both insert and remove take at most three rotations, the height is bounded by 2 log n
+   */
+  struct rb_balance
+  {
+    static const bool joins = false;
+
+    template <class Tree, class Node>
+    static void inserted(Tree &tree, Node *node)
+    {
+      tree.refresh(Tree::parent(node));
+      Tree::rank(node) = red;
+
+      for (Node *x = node; red_node(Tree::parent(x));)
+      {
+        Node *parent = Tree::parent(x);
+        Node *grand = Tree::parent(parent);
+        const int dir = Tree::child(grand, 1) == parent;
+        Node *uncle = Tree::child(grand, !dir);
+        if (red_node(uncle))
+        {
+          Tree::rank(parent) = black;
+          Tree::rank(uncle) = black;
+          Tree::rank(grand) = red;
+          x = grand;
+          continue;
+        }
+        if (Tree::child(parent, !dir) == x)
+        {
+          tree.rotate_up(x);
+          parent = x;
+        }
+        Tree::rank(parent) = black;
+        Tree::rank(grand) = red;
+        tree.rotate_up(parent);
+        break;
+      }
+      Tree::rank(tree.root()) = black;
+
+      tree.refresh(node);
+    }
+
+    template <class Tree, class Node>
+    static void removed(Tree &tree, Node *parent, int dir, unsigned char removed_rank)
+    {
+      tree.refresh(parent);
+
+      Node *x = parent ? Tree::child(parent, dir) : tree.root();
+      if (removed_rank == black)
+      {
+        // x carries an extra black
+        for (Node *p = parent; p && !red_node(x); p = Tree::parent(x))
+        {
+          const int side = x ? Tree::child(p, 1) == x : dir;
+          Node *sibling = Tree::child(p, !side);
+          if (red_node(sibling))
+          {
+            Tree::rank(sibling) = black;
+            Tree::rank(p) = red;
+            tree.rotate_up(sibling);
+            sibling = Tree::child(p, !side);
+          }
+          if (!red_node(Tree::child(sibling, 0)) && !red_node(Tree::child(sibling, 1)))
+          {
+            Tree::rank(sibling) = red;
+            x = p;
+            continue;
+          }
+          if (!red_node(Tree::child(sibling, !side)))
+          {
+            Tree::rank(Tree::child(sibling, side)) = black;
+            Tree::rank(sibling) = red;
+            sibling = tree.rotate_up(Tree::child(sibling, side));
+          }
+          Tree::rank(sibling) = Tree::rank(p);
+          Tree::rank(p) = black;
+          Tree::rank(Tree::child(sibling, !side)) = black;
+          tree.rotate_up(sibling);
+          x = tree.root();
+          break;
+        }
+        if (x)
+        {
+          Tree::rank(x) = black;
+        }
+      }
+
+      tree.refresh(parent);
+    }
+
+    /**
+     * @brief a perfectly balanced tree is red-black when only its deepest level is red
+     */
+    template <class Tree, class Node>
+    static void rebuilt(Tree &tree, Node *node)
+    {
+      if (node)
+      {
+        rebuilt(tree, node, 0, node->height() - 1);
+      }
+    }
+
+  private:
+    static const unsigned char black = 0;
+    static const unsigned char red = 1;
+
+    template <class Node>
+    static bool red_node(const Node *node)
+    {
+      return node && node->rank() == red;
+    }
+
+    template <class Tree, class Node>
+    static void rebuilt(Tree &tree, Node *node, int depth, int deepest)
+    {
+      if (node)
+      {
+        Tree::rank(node) = depth && depth == deepest ? red : black;
+        rebuilt(tree, Tree::child(node, 0), depth + 1, deepest);
+        rebuilt(tree, Tree::child(node, 1), depth + 1, deepest);
+      }
+    }
+  };
+} // namespace avl
+
+template <class T, class Key = int, class Augment = avl::no_augment, class Balance = avl::avl_balance>
+class AvlTree;
+
+template <class T, class Key, class Augment>
+class AvlNodeHandle;
+
+template <class T, class Key = int, class Augment = avl::no_augment>
+class AvlNode : private avl::_augment_slot<Augment>,
+                private avl::_thread_slot<AvlNode<T, Key, Augment>, avl::_threading<Augment>::threaded::value>
+{
+  friend class AvlNodeHandle<T, Key, Augment>;
+  template <class, class, class, class>
+  friend class AvlTree;
+  friend struct avl::_augment_slot<Augment>;
+  friend struct avl::_augment_slot<typename avl::_threading<Augment>::augment>;
+  friend struct avl::_thread_slot<AvlNode<T, Key, Augment>, avl::_threading<Augment>::threaded::value>;
+
+  typedef avl::_thread_slot<AvlNode<T, Key, Augment>, avl::_threading<Augment>::threaded::value> thread_slot;
+
+public:
+  T data;
+
+  AvlNode(const Key &key, const T &data, AvlNode<T, Key, Augment> *parent)
+      : data(data),
+        key_(key),
+        parent_(parent),
+        child_(),
+        height_(1),
+        tombstone_(false),
+        rank_(0),
+        pooled_(false)
+  {
+    this->update_aggregate(this);
+  }
+
+  /**
+   * @brief copy a single node into a clone block, the caller links its children
+   */
+  AvlNode(const AvlNode<T, Key, Augment> &other, AvlNode<T, Key, Augment> *parent, avl::_pooled)
+      : avl::_augment_slot<Augment>(other),
+        data(other.data),
+        key_(other.key_),
+        parent_(parent),
+        child_(),
+        height_(other.height_),
+        tombstone_(other.tombstone_),
+        rank_(other.rank_),
+        pooled_(true)
+  {
+  }
+
+  /**
+   * @brief construct a single node in a node block, the caller links it
+   */
+  AvlNode(const Key &key, const T &data, avl::_pooled)
+      : data(data),
+        key_(key),
+        parent_(NULL),
+        child_(),
+        height_(1),
+        tombstone_(false),
+        rank_(0),
+        pooled_(true)
+  {
+  }
+
+  AvlNode(const AvlNode<T, Key, Augment> &other, AvlNode<T, Key, Augment> *parent = NULL) : avl::_augment_slot<Augment>(other), data(other.data), key_(other.key_), parent_(parent), height_(other.height_), tombstone_(other.tombstone_), rank_(other.rank_), pooled_(false)
+  {
+    child_[0] = AvlNode::clone(other.child_[0], this);
+    child_[1] = AvlNode::clone(other.child_[1], this);
+    if (!parent)
+    {
+      thread_slot::thread(this);
+    }
+  }
+
+  AvlNode<T, Key, Augment> &operator=(const AvlNode<T, Key, Augment> &other)
+  {
+    // Avoid self assignment
+    if (this != &other)
+    {
+      // Avoid assigning parent
+      key_ = other.key_;
+      data = other.data;
+      child_[0] = other.child_[0];
+      child_[1] = other.child_[1];
+      height_ = other.height_;
+      tombstone_ = other.tombstone_;
+      rank_ = other.rank_;
+      thread_slot::operator=(other);
+      avl::_augment_slot<Augment>::operator=(other);
+    }
+
+    return *this;
+  }
+
+  /**
+   * @brief node is equal to another iif keys are equal
+   * @note node comparison is agnostic to data
+   *
+   * @param other
+   * @return true
+   * @return false
+   */
+  bool operator==(const AvlNode<T, Key, Augment> &other) const
+  {
+    return avl::_key_compare<Key>::compare(key_, other.key_) == 0;
+  }
+
+  bool operator!=(const AvlNode<T, Key, Augment> &other)
+  {
+    return !(*this == other);
+  }
+
+  const Key &key() const
+  {
+    return key_;
+  }
+
+  const AvlNode<T, Key, Augment> *parent() const
+  {
+    return parent_;
+  }
+
+  AvlNode<T, Key, Augment> *left() const
+  {
+    return child_[0];
+  }
+
+  AvlNode<T, Key, Augment> *right() const
+  {
+    return child_[1];
+  }
+
+  int height() const
+  {
+    return height_;
+  }
+
+  /**
+   * @brief subtree aggregate, available for augmented nodes only
+   *
+   * @return Augment::value_type combined over this subtree in key order
+   */
+  typename Augment::value_type aggregate() const
+  {
+    return this->aggregate_;
+  }
+
+  /**
+   * @brief a removed node kept in place by a lazy remove, lookup and iteration skip it
+   */
+  bool tombstone() const
+  {
+    return tombstone_;
+  }
+
+  /**
+   * @brief balancing policy state, the rank of weak AVL trees or the color of red-black trees
+   */
+  int rank() const
+  {
+    return rank_;
+  }
+
+  int balance() const
+  {
+    return (child_[0] ? child_[0]->height_ : 0) - (child_[1] ? child_[1]->height_ : 0);
+  }
+
+  int count() const
+  {
+    return (child_[0] ? child_[0]->count() : 0) + 1 + (child_[1] ? child_[1]->count() : 0);
+  }
+
+  AvlNode<T, Key, Augment> *next() const
+  {
+    return next(const_cast<AvlNode<T, Key, Augment> *>(this));
+  }
+
+  AvlNode<T, Key, Augment> *previous() const
+  {
+    return previous(const_cast<AvlNode<T, Key, Augment> *>(this));
+  }
+
+  AvlNode<T, Key, Augment> *min_left()
+  {
+    return min_left(this);
+  }
+
+  AvlNode<T, Key, Augment> *max_right()
+  {
+    return max_right(this);
+  }
+
+  const Key &min_key()
+  {
+    return min_left()->key();
+  }
+
+  const Key &max_key()
+  {
+    return max_right()->key();
+  }
+
+protected:
+  /**
+   * @brief recompute height and subtree aggregate from the children
+   */
+  void update_height()
+  {
+    height_ = 1 + _MAX(child_[0] ? child_[0]->height_ : 0, child_[1] ? child_[1]->height_ : 0);
+    this->update_aggregate(this);
+  }
+
+  AvlNode<T, Key, Augment> *min_left(AvlNode<T, Key, Augment> *node) const
+  {
+    if (!node)
+    {
+      return NULL;
+    }
+    while (node->child_[0])
+    {
+      node = node->child_[0];
+    }
+    return node;
+  }
+
+  AvlNode<T, Key, Augment> *max_right(AvlNode<T, Key, Augment> *node) const
+  {
+    if (!node)
+    {
+      return NULL;
+    }
+    while (node->child_[1])
+    {
+      node = node->child_[1];
+    }
+    return node;
+  }
+
+  /**
+   * @brief Inorder successor skipping tombstones
+   *
+   * @param node
+   * @return AvlNode<T, Key, Augment>*
+   */
+  AvlNode<T, Key, Augment> *next(AvlNode<T, Key, Augment> *node) const
+  {
+    do
+    {
+      node = successor(node);
+    } while (node && node->tombstone_);
+    return node;
+  }
+
+  /**
+   * @brief Inorder predecessor skipping tombstones
+   *
+   * @param node
+   * @return AvlNode<T, Key, Augment>*
+   */
+  AvlNode<T, Key, Augment> *previous(AvlNode<T, Key, Augment> *node) const
+  {
+    do
+    {
+      node = predecessor(node);
+    } while (node && node->tombstone_);
+    return node;
+  }
+
+  /**
+   * @brief Inorder successor
+   * @note The time complexity is O(log n) since the next node is no more than "height" steps away, O(1) for avl::threaded trees
+   *
+   * @param node
+   * @return AvlNode<T, Key, Augment>*
+   */
+  static AvlNode<T, Key, Augment> *successor(AvlNode<T, Key, Augment> *node)
+  {
+    return node ? successor(node, typename avl::_threading<Augment>::threaded()) : NULL;
+  }
+
+  /**
+   * @brief Inorder predecessor
+   * @note The time complexity is O(log n) since the previous node is no more than "height" steps away, O(1) for avl::threaded trees
+   *
+   * @param node
+   * @return AvlNode<T, Key, Augment>*
+   */
+  static AvlNode<T, Key, Augment> *predecessor(AvlNode<T, Key, Augment> *node)
+  {
+    return node ? predecessor(node, typename avl::_threading<Augment>::threaded()) : NULL;
+  }
+
+private:
+  Key key_;
+  AvlNode<T, Key, Augment> *parent_;
+  // left and right children, indexed by the comparison result so descent selects a child without branching
+  AvlNode<T, Key, Augment> *child_[2];
+  int height_;
+  bool tombstone_;
+  unsigned char rank_;
+  // placed in a clone block owned by the tree, rather than allocated on its own
+  bool pooled_;
+
+  static AvlNode<T, Key, Augment> *successor(AvlNode<T, Key, Augment> *node, std::true_type)
+  {
+    return node->link_[1];
+  }
+
+  static AvlNode<T, Key, Augment> *successor(AvlNode<T, Key, Augment> *node, std::false_type)
+  {
+    if (node->child_[1])
+    {
+      return node->child_[1]->min_left();
+    }
+
+    if (!node->parent_)
+    {
+      return NULL;
+    }
+
+    if (node == node->parent_->child_[0])
+    {
+      return node->parent_;
+    }
+
+    AvlNode<T, Key, Augment> *alt = node;
+    while (alt->parent_ && alt->parent_->child_[0] != alt)
+    {
+      alt = alt->parent_;
+    }
+
+    return alt->parent_;
+  }
+
+  static AvlNode<T, Key, Augment> *predecessor(AvlNode<T, Key, Augment> *node, std::true_type)
+  {
+    return node->link_[0];
+  }
+
+  static AvlNode<T, Key, Augment> *predecessor(AvlNode<T, Key, Augment> *node, std::false_type)
+  {
+    if (node->child_[0])
+    {
+      return node->child_[0]->max_right();
+    }
+
+    if (!node->parent_)
+    {
+      return NULL;
+    }
+
+    if (node->parent_->child_[1] == node)
+    {
+      return node->parent_;
+    }
+
+    AvlNode<T, Key, Augment> *alt = node->parent_;
+    while (alt->parent_ && alt->parent_->child_[0] == alt)
+    {
+      alt = alt->parent_;
+    }
+
+    return alt->parent_;
+  }
+
+  static AvlNode<T, Key, Augment> *clone(const AvlNode<T, Key, Augment> *other, AvlNode<T, Key, Augment> *parent = NULL)
+  {
+    if (!other)
+    {
+      return NULL;
+    }
+    return new AvlNode<T, Key, Augment>(*other, parent);
+  }
+};
+
+/**
+ * @brief owns a node taken out of a tree by AvlTree::extract, until it is linked again by AvlTree::insert
+ *
+ * the node keeps its address, key and data, so it may move to another tree with the same node type, or come back under a new key,
+ * with no allocation and no copy. A node of a copy stays in its block, which the handle keeps alive and then hands over to the tree
+ * the node is linked into. An empty handle holds no node, a handle frees its node when destroyed
+ */
+template <class T, class Key, class Augment>
+class AvlNodeHandle
+{
+  template <class, class, class, class>
+  friend class AvlTree;
+
+public:
+  AvlNodeHandle() : node_(NULL), block_(NULL) {}
+
+  AvlNodeHandle(AvlNodeHandle<T, Key, Augment> &&other) : node_(other.node_), block_(other.block_)
+  {
+    other.node_ = NULL;
+    other.block_ = NULL;
+  }
+
+  AvlNodeHandle<T, Key, Augment> &operator=(AvlNodeHandle<T, Key, Augment> &&other)
+  {
+    if (this != &other)
+    {
+      reset();
+      node_ = other.node_;
+      block_ = other.block_;
+      other.node_ = NULL;
+      other.block_ = NULL;
+    }
+    return *this;
+  }
+
+  AvlNodeHandle(const AvlNodeHandle<T, Key, Augment> &) = delete;
+  AvlNodeHandle<T, Key, Augment> &operator=(const AvlNodeHandle<T, Key, Augment> &) = delete;
+
+  ~AvlNodeHandle()
+  {
+    reset();
+  }
+
+  bool empty() const
+  {
+    return node_ == NULL;
+  }
+
+  explicit operator bool() const
+  {
+    return node_ != NULL;
+  }
+
+  const Key &key() const
+  {
+    return node_->key_;
+  }
+
+  /**
+   * @brief re-key the node before inserting it again
+   */
+  void set_key(const Key &key)
+  {
+    node_->key_ = key;
+  }
+
+  T &data()
+  {
+    return node_->data;
+  }
+
+  const T &data() const
+  {
+    return node_->data;
+  }
+
+private:
+  AvlNode<T, Key, Augment> *node_;
+  // block of the node when it was extracted from a copy, NULL for a node of its own
+  avl::_node_block *block_;
+
+  AvlNodeHandle(AvlNode<T, Key, Augment> *node, avl::_node_block *block) : node_(node), block_(block) {}
+
+  /**
+   * @brief give up the node and the reference to its block
+   */
+  AvlNode<T, Key, Augment> *release(avl::_node_block *&block)
+  {
+    AvlNode<T, Key, Augment> *node = node_;
+    block = block_;
+    node_ = NULL;
+    block_ = NULL;
+    return node;
+  }
+
+  void reset()
+  {
+    if (block_)
+    {
+      node_->~AvlNode<T, Key, Augment>();
+      block_->release();
+    }
+    else
+    {
+      delete node_;
+    }
+  }
+};
+
+template <class T, class Key, class Augment, class Balance>
+class AvlTree
+{
+public:
+  typedef AvlNode<T, Key, Augment> node_type;
+  typedef AvlNodeHandle<T, Key, Augment> node_handle;
+
+  AvlTree() : root_(NULL), count_(0){};
+  virtual ~AvlTree()
+  {
+    clear();
+  }
+
+  /**
+   * @brief copy the other tree into a single contiguous node block, keeping its shape
+   */
+  AvlTree(const AvlTree<T, Key, Augment, Balance> &other) : root_(NULL), count_(0)
+  {
+    copy(other, avl::inorder_layout, 1);
+  }
+
+  /**
+   * @brief copy the tree into a single contiguous node block, keeping its shape
+   * @note The time complexity is O(n) with a single allocation. Trees of 2^15 nodes or more are split into
+   *  about sqrt(n) subtrees below half the height, whose sizes are counted and which are copied on several threads
+   *
+   * @param layout node order inside the block
+   * @param threads number of copying threads, 0 for the hardware concurrency
+   * @return AvlTree<T, Key, Augment, Balance>* new tree, owned by the caller
+   */
+  AvlTree<T, Key, Augment, Balance> *clone(avl::clone_layout layout = avl::inorder_layout, unsigned threads = 0) const
+  {
+    AvlTree<T, Key, Augment, Balance> *tree = new AvlTree<T, Key, Augment, Balance>();
+    tree->copy(*this, layout, threads);
+    return tree;
+  }
+
+  AvlTree<T, Key, Augment, Balance> &operator=(const AvlTree<T, Key, Augment, Balance> &other)
+  {
+    // Avoid self assignment
+    if (this != &other)
+    {
+      clear();
+      copy(other, avl::inorder_layout, 1);
+    }
+    return *this;
+  }
+
+  /**
+   * @brief check whether this tree is equal to the specified one using inorder traversal
+   *
+   * only live nodes are compared, tombstones left by a lazy remove are skipped.
+   * For example, the following balanced trees have the same inorder traversal:
+   *
+   *    2      1
+   *   /        \
+   *  1          2
+   *
+   * @param other tree to compare with
+   * @return true if this tree is equivalent to the specified one
+   * @return false if this tree is different from the specified one
+   */
+  bool operator==(const AvlTree<T, Key, Augment, Balance> &other) const
+  {
+    if (count_ != other.count_)
+    {
+      return false;
+    }
+    AvlNode<T, Key, Augment> *this_node = min_left();
+    AvlNode<T, Key, Augment> *other_node = other.min_left();
+    while (this_node && other_node && *this_node == *other_node)
+    {
+      this_node = this_node->next();
+      other_node = other_node->next();
+    }
+    return !this_node && !other_node;
+  }
+
+  bool operator!=(const AvlTree<T, Key, Augment, Balance> &other) const
+  {
+    return !(*this == other);
+  }
+
+  void clear()
+  {
+    AvlTree::clear(root_);
+    _AVL_TELEMETRY(telemetry_.frees += count_ + tombstones_);
+    for (size_t i = 0; i < blocks_.size(); i++)
+    {
+      blocks_[i]->release();
+    }
+    blocks_.clear();
+    compact_block_ = NULL;
+    root_ = NULL;
+    count_ = 0;
+    tombstones_ = 0;
+    max_key_ = Key();
+    min_key_ = Key();
+  }
+
+  bool empty() const
+  {
+    return count() == 0;
+  }
+
+  int count() const
+  {
+    return count_;
+  }
+
+  int height() const
+  {
+    return root_ ? root_->height() : 0;
+  }
+
+  AvlNode<T, Key, Augment> *insert(const Key &key, const T &data = {})
+  {
+    _AVL_TELEMETRY(AvlTelemetry::scope _scope(telemetry_, AvlTelemetry::op_insert));
+    _AVL_TELEMETRY(op_ = AvlTelemetry::op_insert);
+    bool inserted = false;
+    AvlNode<T, Key, Augment> *inserted_node = insert(key, data, inserted);
+    if (!inserted && inserted_node->tombstone_)
+    {
+      // revive a lazily removed node in place
+      inserted_node->data = data;
+      inserted_node->tombstone_ = false;
+      tombstones_--;
+      refresh(inserted_node);
+      inserted = true;
+    }
+    if (inserted)
+    {
+      count_++;
+      if (count_ == 1 || max_key_ < inserted_node->key())
+      {
+        max_key_ = inserted_node->key();
+      }
+      if (count_ == 1 || inserted_node->key() < min_key_)
+      {
+        min_key_ = inserted_node->key();
+      }
+    }
+    return inserted_node;
+  }
+
+  /**
+   * @brief link the node of a handle, taken from this tree or any tree with the same node type
+   * @note The time complexity is O(log n), no node is allocated and no data is copied
+   *
+   * @param handle emptied when its node is linked, left as is when the key is already present
+   * @return AvlNode<T, Key, Augment>* the linked node, the existing node holding the key, or NULL for an empty handle
+   */
+  AvlNode<T, Key, Augment> *insert(node_handle &&handle)
+  {
+    if (!handle)
+    {
+      return NULL;
+    }
+    _AVL_TELEMETRY(AvlTelemetry::scope _scope(telemetry_, AvlTelemetry::op_insert));
+    _AVL_TELEMETRY(op_ = AvlTelemetry::op_insert);
+
+    const Key &key = handle.key();
+    AvlNode<T, Key, Augment> *existing = lookup(root_, key);
+    if (existing && !existing->tombstone_)
+    {
+      return existing;
+    }
+    if (existing)
+    {
+      // the handle node takes the place of a lazily removed node
+      unlink(existing);
+      destroy(existing);
+      _AVL_TELEMETRY(telemetry_.frees++);
+      tombstones_--;
+    }
+
+    AvlNode<T, Key, Augment> *parent = NULL;
+    int dir = 0;
+    for (AvlNode<T, Key, Augment> *node = root_; node; node = node->child_[dir])
+    {
+      _AVL_TELEMETRY(telemetry_.comparisons[AvlTelemetry::op_insert]++);
+      parent = node;
+      dir = avl::_key_compare<Key>::compare(key, node->key_) > 0;
+    }
+
+    avl::_node_block *block = NULL;
+    AvlNode<T, Key, Augment> *node = handle.release(block);
+    if (block)
+    {
+      node = adopt(node, block);
+    }
+    node->tombstone_ = false;
+    node->rank_ = 0;
+    node->update_height();
+    link(node, parent, dir);
+
+    count_++;
+    if (count_ == 1 || max_key_ < node->key_)
+    {
+      max_key_ = node->key_;
+    }
+    if (count_ == 1 || node->key_ < min_key_)
+    {
+      min_key_ = node->key_;
+    }
+    return node;
+  }
+
+  /**
+   * @brief unlink the node of a key and hand it over to the caller
+   * @note The time complexity is O(log n), plus O(b) to find the block of a node of a copy among the b blocks of the tree.
+   *  The node keeps its address, a node of a copy stays in its block until the handle and every tree holding the block let it go
+   *
+   * @return node_handle an empty handle if the key is missing
+   */
+  node_handle extract(const Key &key)
+  {
+    _AVL_TELEMETRY(AvlTelemetry::scope _scope(telemetry_, AvlTelemetry::op_remove));
+    _AVL_TELEMETRY(op_ = AvlTelemetry::op_remove);
+    AvlNode<T, Key, Augment> *node = lookup(root_, key);
+    if (!node || node->tombstone_)
+    {
+      return node_handle();
+    }
+    unlink(node);
+    count_--;
+    min_key_ = count_ ? min_left()->key_ : Key();
+    max_key_ = count_ ? max_right()->key_ : Key();
+
+    avl::_node_block *block = node->pooled_ ? block_of(node) : NULL;
+    if (block)
+    {
+      block->acquire();
+    }
+    return node_handle(node, block);
+  }
+
+  AvlNode<T, Key, Augment> *root() const
+  {
+    return root_;
+  }
+
+  AvlNode<T, Key, Augment> *min_left() const
+  {
+    AvlNode<T, Key, Augment> *node = root_ ? root_->min_left() : NULL;
+    return node && node->tombstone_ ? node->next() : node;
+  }
+
+  AvlNode<T, Key, Augment> *max_right() const
+  {
+    AvlNode<T, Key, Augment> *node = root_ ? root_->max_right() : NULL;
+    return node && node->tombstone_ ? node->previous() : node;
+  }
+
+  const Key &min_key() const
+  {
+    return min_key_;
+  }
+
+  const Key &max_key() const
+  {
+    return max_key_;
+  }
+
+  bool remove(const Key &key, T *removed_data = NULL)
+  {
+    _AVL_TELEMETRY(AvlTelemetry::scope _scope(telemetry_, AvlTelemetry::op_remove));
+    _AVL_TELEMETRY(op_ = AvlTelemetry::op_remove);
+    if (compaction_ratio_ > 0)
+    {
+      return lazy_remove(key, removed_data);
+    }
+
+    AvlNode<T, Key, Augment> *node = lookup(root_, key);
+    if (!node)
+    {
+      return false;
+    }
+    if (removed_data)
+    {
+      *removed_data = node->data;
+    }
+    unlink(node);
+    destroy(node);
+    _AVL_TELEMETRY(telemetry_.frees++);
+
+    count_--;
+    min_key_ = root_ ? root_->min_key() : Key();
+    max_key_ = root_ ? root_->max_key() : Key();
+    return true;
+  }
+
+  /**
+   * @brief recompute heights and aggregates on the way from the node up to the root
+   * @note call it after modifying the data of an augmented node in place, the time complexity is O(log n)
+   *
+   * @param node tree node whose data was modified
+   */
+  void refresh(AvlNode<T, Key, Augment> *node)
+  {
+    for (; node; node = node->parent_)
+    {
+      retrace(node);
+    }
+  }
+
+  AvlNode<T, Key, Augment> *lookup(const Key &key) const
+  {
+    _AVL_TELEMETRY(AvlTelemetry::scope _scope(telemetry_, AvlTelemetry::op_lookup));
+    AvlNode<T, Key, Augment> *node = lookup(root_, key);
+    return node && !node->tombstone_ ? node : NULL;
+  }
+
+  /**
+   * @brief lookup starting from a finger, a node of this tree near the key
+   *
+   * climbs from the finger only up to the first ancestor past the key, then descends,
+   * so a lookup near the finger touches the small subtree spanning both instead of a full root to leaf path
+   * @note The time complexity is O(log d) for keys d positions away from the finger when the subtree spanning them is balanced, O(log n) at worst
+   *
+   * @param key
+   * @param finger a node of this tree or NULL to start at the root, receives the last node visited so it may be passed to the next lookup
+   * @return AvlNode<T, Key, Augment>* NULL if the key is missing
+   */
+  AvlNode<T, Key, Augment> *lookup(const Key &key, AvlNode<T, Key, Augment> *&finger) const
+  {
+    _AVL_TELEMETRY(AvlTelemetry::scope _scope(telemetry_, AvlTelemetry::op_lookup));
+    AvlNode<T, Key, Augment> *node = finger ? finger : root_;
+    if (!node)
+    {
+      return NULL;
+    }
+
+    _AVL_TELEMETRY(telemetry_.comparisons[AvlTelemetry::op_lookup]++);
+    int compare = avl::_key_compare<Key>::compare(key, node->key_);
+    const int dir = compare > 0;
+    while (compare && node->parent_)
+    {
+      AvlNode<T, Key, Augment> *parent = node->parent_;
+      // the parent key is on the finger side of the key
+      if (parent->child_[dir] == node)
+      {
+        node = parent;
+        continue;
+      }
+      _AVL_TELEMETRY(telemetry_.comparisons[AvlTelemetry::op_lookup]++);
+      compare = avl::_key_compare<Key>::compare(key, parent->key_);
+      // the subtree of node spans every key between the finger and the parent
+      if (compare && (compare > 0) != dir)
+      {
+        break;
+      }
+      node = parent;
+    }
+
+    node = descend(node, key, finger);
+    return node && !node->tombstone_ ? node : NULL;
+  }
+
+  /**
+   * @brief lookup a batch of keys, passing the finger from every key to the next
+   * @note The time complexity is O(k log(n / k)) for k sorted keys spread evenly, unsorted keys are found as well but slower
+   *
+   * @param keys preferably in ascending or descending order
+   * @return std::vector<AvlNode<T, Key, Augment> *> the node of every key, NULL for a missing key
+   */
+  std::vector<AvlNode<T, Key, Augment> *> lookup_sorted(const std::vector<Key> &keys) const
+  {
+    std::vector<AvlNode<T, Key, Augment> *> nodes;
+    nodes.reserve(keys.size());
+    AvlNode<T, Key, Augment> *finger = NULL;
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+      nodes.push_back(lookup(keys[i], finger));
+    }
+    return nodes;
+  }
+
+  /**
+   * @brief switch lazy remove on or off
+   *
+   * a lazy remove only marks the node as a tombstone, so it takes a single lookup and no rotations,
+   * once tombstones exceed the compaction ratio of all the nodes the tree is purged in one linear pass
+   *
+   * @param compaction_ratio tombstones ratio that triggers a purge, lazy remove is off when it is not positive
+   */
+  void set_lazy_remove(double compaction_ratio)
+  {
+    compaction_ratio_ = compaction_ratio;
+    if (compaction_ratio_ <= 0)
+    {
+      purge();
+    }
+  }
+
+  /**
+   * @brief number of lazily removed nodes still kept in the tree
+   */
+  int tombstones() const
+  {
+    return tombstones_;
+  }
+
+  /**
+   * @brief free all tombstones and rebuild a perfectly balanced tree from the remaining nodes
+   * @note The time complexity is O(n), live nodes are relinked rather than copied
+   */
+  void purge()
+  {
+    if (!tombstones_)
+    {
+      return;
+    }
+
+    std::vector<AvlNode<T, Key, Augment> *> nodes, dead;
+    nodes.reserve(count_);
+    dead.reserve(tombstones_);
+    // tombstones are freed once the walk is over, the successor walk reads parent links
+    for (AvlNode<T, Key, Augment> *node = root_ ? root_->min_left() : NULL; node; node = AvlNode<T, Key, Augment>::successor(node))
+    {
+      (node->tombstone_ ? dead : nodes).push_back(node);
+    }
+    for (size_t i = 0; i < dead.size(); i++)
+    {
+      destroy(dead[i]);
+    }
+    _AVL_TELEMETRY(telemetry_.frees += tombstones_);
+    tombstones_ = 0;
+    root_ = build(nodes, 0, nodes.size(), NULL);
+    AvlNode<T, Key, Augment>::thread_slot::thread(root_);
+    Balance::rebuilt(*this, root_);
+  }
+
+  /**
+   * @brief replace the content by the given records, sorting them and linking the nodes on several threads
+   * @note The time complexity is O(n log n / threads) to sort runs, plus O(n / threads) per level of run merges.
+   *  The sort is stable, so a repeated key keeps its first data as insert does, and all the nodes share a single block
+   *
+   * @param records (key, data) pairs in any order, pass an rvalue to sort them in place
+   * @param threads number of threads, 0 for all the cores
+   */
+  void bulk_load(std::vector<std::pair<Key, T>> records, unsigned threads = 0)
+  {
+    clear();
+    if (!threads)
+    {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    sort_records(records, threads);
+
+    // every part counts its first occurrences of keys, then constructs them at its offset of the block
+    const size_t parts = std::max<size_t>(1, std::min<size_t>(threads, records.size() / parallel_ingest_run));
+    std::vector<ingest_part> ingest(parts);
+    for (size_t i = 0; i < parts; i++)
+    {
+      ingest[i].first = records.size() * i / parts;
+      ingest[i].last = records.size() * (i + 1) / parts;
+    }
+    for_each_task(ingest, threads, [&records](ingest_part &part)
+                  {
+                    part.kept = 0;
+                    for (size_t i = part.first; i < part.last; i++)
+                    {
+                      part.kept += !i || records[i - 1].first < records[i].first;
+                    } });
+    size_t nodes = 0;
+    for (size_t i = 0; i < parts; i++)
+    {
+      ingest[i].offset = nodes;
+      nodes += ingest[i].kept;
+    }
+    if (!nodes)
+    {
+      return;
+    }
+
+    blocks_.push_back(new avl::_node_block(nodes * sizeof(AvlNode<T, Key, Augment>)));
+    AvlNode<T, Key, Augment> *block = static_cast<AvlNode<T, Key, Augment> *>(blocks_.back()->memory);
+    _AVL_TELEMETRY(telemetry_.allocations += nodes);
+    for_each_task(ingest, threads, [&records, block, nodes](ingest_part &part)
+                  {
+                    size_t at = part.offset;
+                    for (size_t i = part.first; i < part.last; i++)
+                    {
+                      if (!i || records[i - 1].first < records[i].first)
+                      {
+                        AvlNode<T, Key, Augment> *node = new (block + at) AvlNode<T, Key, Augment>(records[i].first, records[i].second, avl::_pooled());
+                        AvlNode<T, Key, Augment>::thread_slot::thread(node, at ? block + at - 1 : NULL, at + 1 < nodes ? block + at + 1 : NULL);
+                        at++;
+                      }
+                    } });
+
+    root_ = build_parallel(block, nodes, threads);
+    Balance::rebuilt(*this, root_);
+    count_ = int(nodes);
+    min_key_ = block[0].key_;
+    max_key_ = block[nodes - 1].key_;
+  }
+
+  /**
+   * @brief relocate all the nodes into a single new block in a cache friendly order, freeing the memory they took before
+   * @note The time complexity is O(n), tombstones are purged first and node addresses change.
+   *  Large trees are copied on several threads, as clone does, and any incremental compaction in progress is dropped
+   *
+   * @param layout node order in the block, van Emde Boas order by default
+   * @param threads number of threads, 0 for all the cores
+   */
+  void compact(avl::clone_layout layout = avl::veb_layout, unsigned threads = 0)
+  {
+    purge();
+    AvlTree<T, Key, Augment, Balance> relocated;
+    relocated.copy(*this, layout, threads);
+    _AVL_TELEMETRY(telemetry_.allocations += count_);
+    _AVL_TELEMETRY(telemetry_.frees += count_);
+    // the former nodes and blocks are freed with the temporary tree
+    std::swap(root_, relocated.root_);
+    blocks_.swap(relocated.blocks_);
+    compact_block_ = NULL;
+  }
+
+  /**
+   * @brief relocate up to the given number of nodes into a compaction block, in ascending key order
+   * @note The time complexity is O(log n + nodes). A compaction cycle sizes its block once, nodes inserted behind the cycle stay where they are,
+   *  and once every node was visited the blocks of former copies and cycles are freed. Node addresses change
+   *
+   * @param nodes maximal number of nodes to relocate in this call
+   * @return true once the compaction cycle is over
+   */
+  bool compact_step(size_t nodes)
+  {
+    if (!compact_block_)
+    {
+      if (!root_)
+      {
+        return true;
+      }
+      compact_capacity_ = count_ + tombstones_;
+      compact_used_ = 0;
+      compact_started_ = false;
+      blocks_.push_back(new avl::_node_block(compact_capacity_ * sizeof(AvlNode<T, Key, Augment>)));
+      compact_block_ = static_cast<AvlNode<T, Key, Augment> *>(blocks_.back()->memory);
+      _AVL_TELEMETRY(telemetry_.allocations += compact_capacity_);
+    }
+
+    // the first node after the last one relocated
+    AvlNode<T, Key, Augment> *node = NULL;
+    for (AvlNode<T, Key, Augment> *candidate = root_; candidate;)
+    {
+      if (compact_started_ && !(compact_key_ < candidate->key_))
+      {
+        candidate = candidate->child_[1];
+      }
+      else
+      {
+        node = candidate;
+        candidate = candidate->child_[0];
+      }
+    }
+
+    const std::less<const void *> before;
+    for (; node && nodes; nodes--)
+    {
+      compact_key_ = node->key_;
+      compact_started_ = true;
+      if (before(node, compact_block_) || !before(node, compact_block_ + compact_capacity_))
+      {
+        // a full block leaves heap nodes in place, but still moves nodes out of the blocks to be freed
+        if (compact_used_ < compact_capacity_)
+        {
+          node = relocate(node, new (compact_block_ + compact_used_++) AvlNode<T, Key, Augment>(node->key_, node->data, avl::_pooled()));
+        }
+        else if (node->pooled_)
+        {
+          node = relocate(node, new AvlNode<T, Key, Augment>(node->key_, node->data, NULL));
+        }
+      }
+      node = AvlNode<T, Key, Augment>::successor(node);
+    }
+    if (node)
+    {
+      return false;
+    }
+
+    avl::_node_block *kept = NULL;
+    for (size_t i = 0; i < blocks_.size(); i++)
+    {
+      if (blocks_[i]->memory == compact_block_)
+      {
+        kept = blocks_[i];
+      }
+      else
+      {
+        blocks_[i]->release();
+      }
+    }
+    blocks_.assign(1, kept);
+    compact_block_ = NULL;
+    return true;
+  }
+
+  /**
+   * @brief remove every key in [lo, hi] at once
+   * @note With AVL balancing the range is split off and the remaining subtrees joined back in O(log n), plus O(k) to free k nodes,
+   *  other balancing policies unlink the nodes one by one in O(k log n)
+   *
+   * @return int number of keys removed
+   */
+  int erase_range(const Key &lo, const Key &hi)
+  {
+    std::vector<AvlNode<T, Key, Augment> *> nodes;
+    const int removed = detach_range(lo, hi, nodes);
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+      destroy(nodes[i]);
+    }
+    _AVL_TELEMETRY(telemetry_.frees += nodes.size());
+    return removed;
+  }
+
+  /**
+   * @brief move every key in [lo, hi] to a new tree, as erase_range does
+   * @note The new tree is built perfectly balanced in O(k), nodes keep their address, and the new tree shares the blocks
+   *  of the nodes of a copy with this tree
+   *
+   * @return AvlTree<T, Key, Augment, Balance>* the range, owned by the caller
+   */
+  AvlTree<T, Key, Augment, Balance> *extract_range(const Key &lo, const Key &hi)
+  {
+    std::vector<AvlNode<T, Key, Augment> *> nodes;
+    AvlTree<T, Key, Augment, Balance> *range = new AvlTree<T, Key, Augment, Balance>();
+    range->count_ = detach_range(lo, hi, nodes);
+
+    size_t live = 0;
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+      AvlNode<T, Key, Augment> *node = nodes[i];
+      if (node->tombstone_)
+      {
+        destroy(node);
+        _AVL_TELEMETRY(telemetry_.frees++);
+        continue;
+      }
+      if (node->pooled_)
+      {
+        avl::_node_block *block = block_of(node);
+        block->acquire();
+        range->adopt(node, block);
+      }
+      nodes[live++] = node;
+    }
+    nodes.resize(live);
+
+    range->root_ = build(nodes, 0, live, NULL);
+    AvlNode<T, Key, Augment>::thread_slot::thread(range->root_);
+    Balance::rebuilt(*range, range->root_);
+    if (live)
+    {
+      range->min_key_ = nodes.front()->key_;
+      range->max_key_ = nodes.back()->key_;
+    }
+    return range;
+  }
+
+  /**
+   * @brief aggregate of all the nodes with keys in [lo, hi], available for augmented trees only
+   * @note The time complexity is O(log n) since only the two boundary paths below the split node are visited
+   *
+   * @param lo lowest key in range
+   * @param hi highest key in range
+   * @return Augment::value_type combined in key order, Augment::identity() for an empty range
+   */
+  typename Augment::value_type aggregate(const Key &lo, const Key &hi) const
+  {
+    return aggregate(&lo, true, &hi, true);
+  }
+
+  /**
+   * @brief aggregate of the whole tree, available for augmented trees only
+   */
+  typename Augment::value_type aggregate() const
+  {
+    return root_ ? root_->aggregate() : Augment::identity();
+  }
+
+  /**
+   * @brief visit the keys whose presence or data differ between this tree and the other, in ascending order
+   * @note available for trees augmented by avl::hash_augment, or by any policy whose aggregate identifies the content.
+   *  Subtrees of this tree whose hash matches the hash of the same key range in the other tree are pruned,
+   *  so d differences cost O(d log^2 n) rather than O(n): every visited node takes an O(log n) range hash of the other tree
+   *
+   * @param other tree to compare with
+   * @param visit called as visit(const Key &)
+   */
+  template <class Visitor>
+  void diff(const AvlTree<T, Key, Augment, Balance> &other, Visitor visit) const
+  {
+    diff(other, root_, NULL, NULL, visit);
+  }
+
+  /**
+   * @brief the keys whose presence or data differ between this tree and the other, in ascending order
+   */
+  std::vector<Key> diff(const AvlTree<T, Key, Augment, Balance> &other) const
+  {
+    std::vector<Key> keys;
+    diff(other, [&keys](const Key &key)
+         { keys.push_back(key); });
+    return keys;
+  }
+
+  /**
+   * @brief visit every node on several threads
+   * @note the tree is split into subtrees of about grain nodes and the nodes above them, idle threads pick the next pending piece.
+   *  Visits run concurrently and in no particular order, the tree must not be modified meanwhile except for the visited data.
+   *  Aggregates of augmented trees are recomputed afterwards, in parallel as well
+   *
+   * @param visit called as visit(const Key &, T &)
+   * @param threads number of threads, 0 for the hardware concurrency
+   * @param grain number of nodes visited by a single piece
+   */
+  template <class Visitor>
+  void parallel_for_each(Visitor visit, unsigned threads = 0, size_t grain = 4096)
+  {
+    const int height = grain_height(grain);
+    std::vector<walk_piece> pieces;
+    AvlTree::pieces(root_, height, pieces);
+    for_each_task(pieces, threads, [&visit](walk_piece &piece)
+                  { AvlTree::for_each(piece.node, piece.subtree, visit); });
+
+    if (!std::is_same<typename avl::_threading<Augment>::augment, avl::no_augment>::value)
+    {
+      for_each_task(pieces, threads, [](walk_piece &piece)
+                    {
+                      if (piece.subtree)
+                      {
+                        AvlTree::recompute(piece.node, 0);
+                      } });
+      recompute(root_, height);
+    }
+  }
+
+  /**
+   * @brief reduce every node on several threads, in ascending key order
+   * @note pieces are reduced concurrently, then their results are combined in key order,
+   *  so combine must be associative but it is not required to be commutative
+   *
+   * @param init identity of combine, it seeds every piece
+   * @param map called as map(const Key &, const T &), returns R
+   * @param combine called as combine(const R &, const R &), returns R
+   * @param threads number of threads, 0 for the hardware concurrency
+   * @param grain number of nodes reduced by a single piece
+   * @return R combine of init and all the mapped nodes in ascending key order
+   */
+  template <class R, class Map, class Combine>
+  R parallel_reduce(const R &init, Map map, Combine combine, unsigned threads = 0, size_t grain = 4096) const
+  {
+    std::vector<walk_piece> pieces;
+    AvlTree::pieces(root_, grain_height(grain), pieces);
+    std::vector<R> results(pieces.size(), init);
+    for_each_task(pieces, threads, [&](walk_piece &piece)
+                  {
+                    R &result = results[&piece - &pieces[0]];
+                    const auto reduce = [&](const Key &key, const T &data)
+                    { result = combine(result, map(key, data)); };
+                    AvlTree::for_each(piece.node, piece.subtree, reduce); });
+
+    R result = init;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+      result = combine(result, results[i]);
+    }
+    return result;
+  }
+
+#ifdef AVL_TELEMETRY
+  const AvlTelemetry &telemetry() const
+  {
+    return telemetry_;
+  }
+
+  void reset_telemetry()
+  {
+    telemetry_.reset();
+  }
+#endif
+
+private:
+  AvlNode<T, Key, Augment> *root_ = NULL;
+  int count_ = 0;
+  Key max_key_ = Key();
+  Key min_key_ = Key();
+  int tombstones_ = 0;
+  double compaction_ratio_ = 0;
+  // node blocks of copies, bulk loads and compactions, released by clear
+  std::vector<avl::_node_block *> blocks_;
+  // block filled by compact_step, NULL when no incremental compaction is in progress
+  AvlNode<T, Key, Augment> *compact_block_ = NULL;
+  size_t compact_used_ = 0;
+  size_t compact_capacity_ = 0;
+  // nodes up to this key were relocated, unless no node was visited yet
+  Key compact_key_ = Key();
+  bool compact_started_ = false;
+  _AVL_TELEMETRY(AvlTelemetry::op op_ = AvlTelemetry::op_lookup);
+
+  friend Balance;
+
+  static AvlNode<T, Key, Augment> *parent(AvlNode<T, Key, Augment> *node)
+  {
+    return node->parent_;
+  }
+
+  static AvlNode<T, Key, Augment> *&child(AvlNode<T, Key, Augment> *node, int dir)
+  {
+    return node->child_[dir];
+  }
+
+  static unsigned char &rank(AvlNode<T, Key, Augment> *node)
+  {
+    return node->rank_;
+  }
+
+  /**
+   * @brief recompute a single node height and aggregate from its children
+   */
+  void retrace(AvlNode<T, Key, Augment> *node)
+  {
+    node->update_height();
+    _AVL_TELEMETRY(telemetry_.retrace_levels++);
+  }
+
+  /**
+   * @brief rotate the node above its parent, keeping the order
+   *
+   * @param node child to lift
+   * @return AvlNode<T, Key, Augment>* the node, now the root of its parent former subtree
+   */
+  AvlNode<T, Key, Augment> *rotate_up(AvlNode<T, Key, Augment> *node)
+  {
+    AvlNode<T, Key, Augment> *parent = node->parent_;
+    AvlNode<T, Key, Augment> *grand = parent->parent_;
+    if (parent->child_[0] == node)
+    {
+      rotate_right(parent);
+      _AVL_TELEMETRY(telemetry_.rotations_right[op_]++);
+    }
+    else
+    {
+      rotate_left(parent);
+      _AVL_TELEMETRY(telemetry_.rotations_left[op_]++);
+    }
+    if (grand)
+    {
+      grand->child_[grand->child_[1] == parent] = node;
+    }
+    else
+    {
+      root_ = node;
+    }
+    return node;
+  }
+
+  /**
+   * @brief replace the subtree rooted at node with the replacement subtree
+   */
+  void transplant(AvlNode<T, Key, Augment> *node, AvlNode<T, Key, Augment> *replacement)
+  {
+    if (!node->parent_)
+    {
+      root_ = replacement;
+    }
+    else
+    {
+      node->parent_->child_[node->parent_->child_[1] == node] = replacement;
+    }
+    if (replacement)
+    {
+      replacement->parent_ = node->parent_;
+    }
   }
+  _AVL_TELEMETRY(mutable AvlTelemetry telemetry_);
 
-  AvlNode(const AvlNode<T> &other, AvlNode<T> *parent = NULL) : data(other.data), key_(other.key_), parent_(parent), height_(other.height_)
+  /**
+   * @brief detach every node with a key in [lo, hi], tombstones included
+   *
+   * @param nodes receives the detached nodes in key order
+   * @return int number of live keys detached
+   */
+  int detach_range(const Key &lo, const Key &hi, std::vector<AvlNode<T, Key, Augment> *> &nodes)
   {
-    left_ = AvlNode::clone(other.left_, this);
-    right_ = AvlNode::clone(other.right_, this);
-  }
+    _AVL_TELEMETRY(AvlTelemetry::scope _scope(telemetry_, AvlTelemetry::op_remove));
+    _AVL_TELEMETRY(op_ = AvlTelemetry::op_remove);
+    if (hi < lo)
+    {
+      return 0;
+    }
 
-  AvlNode<T> &operator=(const AvlNode<T> &other)
-  {
-    // Avoid self assignment
-    if (this != &other)
+    AvlNode<T, Key, Augment> *first = NULL;
+    for (AvlNode<T, Key, Augment> *node = root_; node;)
     {
-      // Avoid assigning parent
-      key_ = other.key_;
-      data = other.data;
-      left_ = other.left_;
-      right_ = other.right_;
-      height_ = other.height_;
+      _AVL_TELEMETRY(telemetry_.comparisons[AvlTelemetry::op_remove]++);
+      if (node->key_ < lo)
+      {
+        node = node->child_[1];
+      }
+      else
+      {
+        first = node;
+        node = node->child_[0];
+      }
+    }
+    int live = 0;
+    for (AvlNode<T, Key, Augment> *node = first; node && !(hi < node->key_); node = AvlNode<T, Key, Augment>::successor(node))
+    {
+      nodes.push_back(node);
+      live += !node->tombstone_;
+    }
+    if (nodes.empty())
+    {
+      return 0;
     }
 
-    return *this;
+    detach(lo, hi, nodes, std::integral_constant<bool, Balance::joins>());
+    count_ -= live;
+    tombstones_ -= int(nodes.size()) - live;
+    min_key_ = count_ ? min_left()->key_ : Key();
+    max_key_ = count_ ? max_right()->key_ : Key();
+    return live;
   }
 
   /**
-   * @brief node is equal to another iif keys are equal
-   * @note node comparison is agnostic to data
-   *
-   * @param other
-   * @return true
-   * @return false
+   * @brief split the range off and join the subtrees around it
    */
-  bool operator==(const AvlNode<T> &other) const
+  void detach(const Key &lo, const Key &hi, const std::vector<AvlNode<T, Key, Augment> *> &nodes, std::true_type)
   {
-    return key_ == other.key_;
-  }
+    AvlNode<T, Key, Augment>::thread_slot::unsplice(nodes.front(), nodes.back());
 
-  bool operator!=(const AvlNode<T> &other)
-  {
-    return !(*this == other);
+    AvlNode<T, Key, Augment> *left, *middle, *right;
+    split(root_, lo, false, left, right);
+    split(right, hi, true, middle, right);
+    if (left && right)
+    {
+      // the lowest node of the right part links both parts
+      AvlNode<T, Key, Augment> *pivot;
+      split(right, right->min_left()->key_, true, pivot, right);
+      root_ = join(left, pivot, right);
+    }
+    else
+    {
+      root_ = left ? left : right;
+    }
   }
 
-  int key() const
+  /**
+   * @brief unlink the range nodes one by one, for balancing policies that do not join
+   */
+  void detach(const Key &, const Key &, const std::vector<AvlNode<T, Key, Augment> *> &nodes, std::false_type)
   {
-    return key_;
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+      unlink(nodes[i]);
+    }
   }
 
-  const AvlNode<T> *parent() const
+  /**
+   * @brief split a detached subtree into the keys before the given key and the others
+   * @note The time complexity is O(log n), the join heights along the path add up to the subtree height
+   *
+   * @param inclusive whether the key itself goes to the left part
+   */
+  void split(AvlNode<T, Key, Augment> *node, const Key &key, bool inclusive, AvlNode<T, Key, Augment> *&left, AvlNode<T, Key, Augment> *&right)
   {
-    return parent_;
-  }
+    if (!node)
+    {
+      left = right = NULL;
+      return;
+    }
 
-  AvlNode<T> *left() const
-  {
-    return left_;
+    AvlNode<T, Key, Augment> *lower = node->child_[0], *upper = node->child_[1];
+    if (lower)
+    {
+      lower->parent_ = NULL;
+    }
+    if (upper)
+    {
+      upper->parent_ = NULL;
+    }
+    _AVL_TELEMETRY(telemetry_.comparisons[op_]++);
+    if (node->key_ < key || (inclusive && !(key < node->key_)))
+    {
+      split(upper, key, inclusive, left, right);
+      left = join(lower, node, left);
+    }
+    else
+    {
+      split(lower, key, inclusive, left, right);
+      right = join(right, node, upper);
+    }
   }
 
-  AvlNode<T> *right() const
+  /**
+   * @brief join two detached subtrees and a pivot node ordered between them
+   * @note The time complexity is O(1 + |height(left) - height(right)|)
+   *
+   * @return AvlNode<T, Key, Augment>* the joined subtree root
+   */
+  AvlNode<T, Key, Augment> *join(AvlNode<T, Key, Augment> *left, AvlNode<T, Key, Augment> *pivot, AvlNode<T, Key, Augment> *right)
   {
-    return right_;
-  }
+    const int left_height = left ? left->height_ : 0;
+    const int right_height = right ? right->height_ : 0;
+    // the taller side, whose inner spine receives the pivot
+    const int dir = left_height < right_height;
+    AvlNode<T, Key, Augment> *tall = dir ? right : left;
+    AvlNode<T, Key, Augment> *other = dir ? left : right;
+    const int other_height = dir ? left_height : right_height;
+
+    AvlNode<T, Key, Augment> *parent = NULL, *node = tall;
+    while (node && node->height_ > other_height + 1)
+    {
+      parent = node;
+      node = node->child_[!dir];
+    }
 
-  int height() const
-  {
-    return height_;
-  }
+    pivot->parent_ = parent;
+    pivot->child_[dir] = node;
+    pivot->child_[!dir] = other;
+    if (node)
+    {
+      node->parent_ = pivot;
+    }
+    if (other)
+    {
+      other->parent_ = pivot;
+    }
+    retrace(pivot);
+    if (!parent)
+    {
+      return pivot;
+    }
 
-  int balance() const
-  {
-    return (left_ ? left_->height_ : 0) - (right_ ? right_->height_ : 0);
+    parent->child_[!dir] = pivot;
+    AvlNode<T, Key, Augment> *root = root_;
+    root_ = tall;
+    Balance::joined(*this, pivot);
+    std::swap(root, root_);
+    return root;
   }
 
-  int count() const
+  /**
+   * @brief move a node to its new copy, relinking its parent, children and neighbors, and free the node
+   *
+   * @return AvlNode<T, Key, Augment>* the new copy
+   */
+  AvlNode<T, Key, Augment> *relocate(AvlNode<T, Key, Augment> *node, AvlNode<T, Key, Augment> *moved)
   {
-    return (left_ ? left_->count : 0) + 1 + (right_ ? right_->count() : 0);
+    moved->parent_ = node->parent_;
+    moved->height_ = node->height_;
+    moved->tombstone_ = node->tombstone_;
+    moved->rank_ = node->rank_;
+    for (int dir = 0; dir < 2; dir++)
+    {
+      moved->child_[dir] = node->child_[dir];
+      if (moved->child_[dir])
+      {
+        moved->child_[dir]->parent_ = moved;
+      }
+    }
+    AvlNode<T, Key, Augment>::thread_slot::relink(node, moved);
+    if (moved->parent_)
+    {
+      moved->parent_->child_[moved->parent_->child_[1] == node] = moved;
+    }
+    else
+    {
+      root_ = moved;
+    }
+    moved->update_height();
+    _AVL_TELEMETRY(telemetry_.frees += !node->pooled_);
+    destroy(node);
+    return moved;
   }
 
-  AvlNode<T> *next() const
-  {
-    return next(const_cast<AvlNode<T> *>(this));
-  }
+  // records sorted or merged by a single thread at least
+  static const size_t parallel_ingest_run = 1 << 14;
 
-  AvlNode<T> *previous() const
+  /**
+   * @brief records of a bulk load handled by a single thread
+   */
+  struct ingest_part
   {
-    return previous(const_cast<AvlNode<T> *>(this));
-  }
+    size_t first;
+    size_t last;
+    size_t kept;
+    size_t offset;
+  };
 
-  AvlNode<T> *min_left()
+  /**
+   * @brief merge the records [a, a_end) and [b, b_end) to the other buffer from position out on
+   */
+  struct merge_task
   {
-    return min_left(this);
-  }
+    size_t a;
+    size_t a_end;
+    size_t b;
+    size_t b_end;
+    size_t out;
+  };
 
-  AvlNode<T> *max_right()
+  /**
+   * @brief stable sort by key, a run per thread is sorted and then pairs of runs are merged, every merge split between the threads
+   */
+  static void sort_records(std::vector<std::pair<Key, T>> &records, unsigned threads)
   {
-    return max_right(this);
-  }
+    typedef std::pair<Key, T> record;
+    const auto before = [](const record &a, const record &b)
+    { return a.first < b.first; };
 
-  int min_key()
-  {
-    return min_left()->key();
+    const size_t runs = std::max<size_t>(1, std::min<size_t>(threads, records.size() / parallel_ingest_run));
+    std::vector<size_t> bounds, sorts;
+    for (size_t i = 0; i <= runs; i++)
+    {
+      bounds.push_back(records.size() * i / runs);
+    }
+    for (size_t i = 0; i < runs; i++)
+    {
+      sorts.push_back(i);
+    }
+    for_each_task(sorts, threads, [&records, &bounds, &before](size_t run)
+                  { std::stable_sort(records.begin() + bounds[run], records.begin() + bounds[run + 1], before); });
+    if (runs == 1)
+    {
+      return;
+    }
+
+    std::vector<record> buffer(records.size());
+    std::vector<record> *from = &records, *to = &buffer;
+    while (bounds.size() > 2)
+    {
+      std::vector<merge_task> tasks;
+      std::vector<size_t> merged(1, 0);
+      for (size_t run = 0; run + 1 < bounds.size(); run += 2)
+      {
+        const size_t a = bounds[run], b = bounds[run + 1], end = run + 2 < bounds.size() ? bounds[run + 2] : b;
+        // the records before every cut of the first run, and the records of the second run with lower keys, merge on their own
+        size_t a_from = a, b_from = b;
+        for (size_t part = 1; part <= threads; part++)
+        {
+          const size_t a_cut = part == threads ? b : a + (b - a) * part / threads;
+          const size_t b_cut = a_cut == b ? end : std::lower_bound(from->begin() + b, from->begin() + end, (*from)[a_cut], before) - from->begin();
+          const merge_task task = {a_from, a_cut, b_from, b_cut, a_from + b_from - b};
+          tasks.push_back(task);
+          a_from = a_cut;
+          b_from = b_cut;
+        }
+        merged.push_back(end);
+      }
+      for_each_task(tasks, threads, [from, to, &before](merge_task &task)
+                    { std::merge(std::make_move_iterator(from->begin() + task.a), std::make_move_iterator(from->begin() + task.a_end),
+                                 std::make_move_iterator(from->begin() + task.b), std::make_move_iterator(from->begin() + task.b_end),
+                                 to->begin() + task.out, before); });
+      bounds.swap(merged);
+      std::swap(from, to);
+    }
+    if (from != &records)
+    {
+      records.swap(buffer);
+    }
   }
 
-  int max_key()
+  /**
+   * @brief the consecutive nodes of a block, indexed like a vector of node pointers
+   */
+  struct block_nodes
   {
-    return max_right()->key();
-  }
+    AvlNode<T, Key, Augment> *block;
 
-protected:
-  void update_height()
+    AvlNode<T, Key, Augment> *operator[](size_t index) const
+    {
+      return block + index;
+    }
+  };
+
+  /**
+   * @brief a subtree of a block linked on its own by a build thread
+   */
+  struct build_task
   {
-    height_ = 1 + _MAX(left_ ? left_->height_ : 0, right_ ? right_->height_ : 0);
-  }
+    size_t first;
+    size_t last;
+    AvlNode<T, Key, Augment> *parent;
+    int dir;
+  };
 
-  AvlNode<T> *min_left(AvlNode<T> *node) const
+  /**
+   * @brief link the sorted nodes of a block as a perfectly balanced tree, the top levels serially and the subtrees below them on several threads
+   */
+  static AvlNode<T, Key, Augment> *build_parallel(AvlNode<T, Key, Augment> *block, size_t nodes, unsigned threads)
   {
-    if (!node)
+    const block_nodes sorted = {block};
+    if (threads < 2 || nodes < parallel_clone_nodes)
     {
-      return NULL;
+      return build(sorted, 0, nodes, NULL);
     }
-    while (node->left_)
+
+    // four subtrees per thread at least
+    int depth = 1;
+    while ((size_t(1) << depth) < 4 * size_t(threads))
     {
-      node = node->left_;
+      depth++;
     }
-    return node;
+    std::vector<build_task> tasks;
+    AvlNode<T, Key, Augment> *root = build_top(sorted, 0, nodes, NULL, 0, depth, tasks);
+    for_each_task(tasks, threads, [&sorted](build_task &task)
+                  { task.parent->child_[task.dir] = build(sorted, task.first, task.last, task.parent); });
+    update_top(root, depth);
+    return root;
   }
 
-  AvlNode<T> *max_right(AvlNode<T> *node) const
+  static AvlNode<T, Key, Augment> *build_top(const block_nodes &nodes, size_t first, size_t last, AvlNode<T, Key, Augment> *parent, int dir, int depth, std::vector<build_task> &tasks)
   {
-    if (!node)
+    if (first >= last)
     {
       return NULL;
     }
-    while (node->right_)
+    if (!depth)
     {
-      node = node->right_;
+      const build_task task = {first, last, parent, dir};
+      tasks.push_back(task);
+      return NULL;
     }
+    const size_t middle = first + (last - first) / 2;
+    AvlNode<T, Key, Augment> *node = nodes[middle];
+    node->parent_ = parent;
+    node->child_[0] = build_top(nodes, first, middle, node, 0, depth - 1, tasks);
+    node->child_[1] = build_top(nodes, middle + 1, last, node, 1, depth - 1, tasks);
     return node;
   }
 
   /**
-   * @brief Inorder successor
-   * @note The time complexity is O(log n) since the next node is no more than "height" steps away
+   * @brief recompute heights and aggregates of the given number of top levels, once the subtrees below are linked
+   */
+  static void update_top(AvlNode<T, Key, Augment> *node, int depth)
+  {
+    if (node && depth)
+    {
+      update_top(node->child_[0], depth - 1);
+      update_top(node->child_[1], depth - 1);
+      node->update_height();
+    }
+  }
+
+  /**
+   * @brief link the sorted nodes [first, last) as a perfectly balanced subtree
+   * @note The time complexity is O(n), the recursion depth is O(log n)
    *
-   * @param node
-   * @return AvlNode<T>*
+   * @return AvlNode<T, Key, Augment>* subtree root
    */
-  AvlNode<T> *next(AvlNode<T> *node) const
+  template <class Nodes>
+  static AvlNode<T, Key, Augment> *build(const Nodes &nodes, size_t first, size_t last, AvlNode<T, Key, Augment> *parent)
   {
-    if (!node)
+    if (first >= last)
     {
       return NULL;
     }
+    const size_t middle = first + (last - first) / 2;
+    AvlNode<T, Key, Augment> *node = nodes[middle];
+    node->parent_ = parent;
+    node->child_[0] = build(nodes, first, middle, node);
+    node->child_[1] = build(nodes, middle + 1, last, node);
+    node->update_height();
+    return node;
+  }
+
+  /**
+   * @brief aggregate of all the nodes with keys between the bounds
+   * @note The time complexity is O(log n) since only the two boundary paths below the split node are visited
+   *
+   * @param lo lowest key, NULL for no lower bound
+   * @param lo_inclusive whether lo itself is in range
+   * @param hi highest key, NULL for no upper bound
+   * @param hi_inclusive whether hi itself is in range
+   * @return Augment::value_type combined in key order, Augment::identity() for an empty range
+   */
+  typename Augment::value_type aggregate(const Key *lo, bool lo_inclusive, const Key *hi, bool hi_inclusive) const
+  {
+    typedef avl::_augment_slot<Augment> slot;
 
-    if (node->right_)
+    const auto above = [lo, lo_inclusive](const AvlNode<T, Key, Augment> *node)
+    { return !lo || (lo_inclusive ? !(node->key_ < *lo) : *lo < node->key_); };
+    const auto below = [hi, hi_inclusive](const AvlNode<T, Key, Augment> *node)
+    { return !hi || (hi_inclusive ? !(*hi < node->key_) : node->key_ < *hi); };
+
+    AvlNode<T, Key, Augment> *split = root_;
+    while (split && !(above(split) && below(split)))
     {
-      return node->right_->min_left();
+      split = above(split) ? split->child_[0] : split->child_[1];
     }
-
-    if (!node->parent_)
+    if (!split)
     {
-      return NULL;
+      return Augment::identity();
     }
 
-    if (node == node->parent_->left_)
+    // nodes in range below the split are a suffix of its left subtree and a prefix of its right subtree
+    typename Augment::value_type left = Augment::identity();
+    for (AvlNode<T, Key, Augment> *node = split->child_[0]; node;)
     {
-      return node->parent_;
+      if (above(node))
+      {
+        left = Augment::combine(Augment::combine(slot::lift_of(node), slot::aggregate_of(node->child_[1])), left);
+        node = node->child_[0];
+      }
+      else
+      {
+        node = node->child_[1];
+      }
     }
 
-    AvlNode<T> *alt = node;
-    while (alt->parent_ && alt->parent_->left_ != alt)
+    typename Augment::value_type right = Augment::identity();
+    for (AvlNode<T, Key, Augment> *node = split->child_[1]; node;)
     {
-      alt = alt->parent_;
+      if (below(node))
+      {
+        right = Augment::combine(right, Augment::combine(slot::aggregate_of(node->child_[0]), slot::lift_of(node)));
+        node = node->child_[1];
+      }
+      else
+      {
+        node = node->child_[0];
+      }
     }
 
-    return alt->parent_;
+    return Augment::combine(Augment::combine(left, slot::lift_of(split)), right);
   }
 
   /**
-   * @brief Inorder predecessor
-   * @note The time complexity is O(log n) since the previous node is no more than "height" steps away
-   *
-   * @param node
-   * @return AvlNode<T>*
+   * @brief compare the subtree of this tree with the same open key range (lo, hi) of the other tree
    */
-  AvlNode<T> *previous(const AvlNode<T> *node) const
+  template <class Visitor>
+  void diff(const AvlTree<T, Key, Augment, Balance> &other, const AvlNode<T, Key, Augment> *node, const Key *lo, const Key *hi, Visitor &visit) const
   {
+    typedef avl::_augment_slot<Augment> slot;
+
     if (!node)
     {
-      return NULL;
+      // whatever the other tree holds in range is missing here
+      AvlNode<T, Key, Augment> *first = NULL;
+      for (AvlNode<T, Key, Augment> *candidate = other.root_; candidate;)
+      {
+        if (!lo || *lo < candidate->key_)
+        {
+          first = candidate;
+          candidate = candidate->child_[0];
+        }
+        else
+        {
+          candidate = candidate->child_[1];
+        }
+      }
+      for (first = first && first->tombstone_ ? first->next() : first; first && (!hi || first->key_ < *hi); first = first->next())
+      {
+        visit(first->key_);
+      }
+      return;
     }
 
-    if (node->left_)
+    if (node->aggregate() == other.aggregate(lo, false, hi, false))
     {
-      return node->left_->max_right();
+      return;
     }
 
-    if (!node->parent_)
+    diff(other, node->child_[0], lo, &node->key_, visit);
+    const AvlNode<T, Key, Augment> *match = other.lookup(other.root_, node->key_);
+    if (match && match->tombstone_)
     {
-      return NULL;
+      match = NULL;
+    }
+    if (node->tombstone_ ? match != NULL : !match || slot::lift_of(node) != slot::lift_of(match))
+    {
+      visit(node->key_);
     }
+    diff(other, node->child_[1], &node->key_, hi, visit);
+  }
 
-    if (node->parent_->right_ == node)
+  /**
+   * @brief mark the node as a tombstone, the tree is purged once tombstones pass the compaction ratio
+   */
+  bool lazy_remove(const Key &key, T *removed_data)
+  {
+    AvlNode<T, Key, Augment> *node = lookup(root_, key);
+    if (!node || node->tombstone_)
     {
-      return node->parent_;
+      return false;
     }
+    if (removed_data)
+    {
+      *removed_data = node->data;
+    }
+    node->tombstone_ = true;
+    refresh(node);
+    count_--;
+    tombstones_++;
 
-    AvlNode<T> *alt = node->parent_;
-    while (alt->parent_ && alt->parent_->left_ == alt)
+    if (!count_)
     {
-      alt = alt->parent_;
+      min_key_ = max_key_ = Key();
+    }
+    else if (!(min_key_ < key))
+    {
+      min_key_ = node->next()->key_;
+    }
+    else if (!(key < max_key_))
+    {
+      max_key_ = node->previous()->key_;
     }
 
-    return alt->parent_;
+    if (tombstones_ > compaction_ratio_ * (count_ + tombstones_))
+    {
+      purge();
+    }
+    return true;
   }
 
-private:
-  int key_;
-  AvlNode<T> *parent_;
-  AvlNode<T> *left_;
-  AvlNode<T> *right_;
-  int height_;
+  /**
+   * @brief the block holding a node of a copy
+   */
+  avl::_node_block *block_of(const AvlNode<T, Key, Augment> *node) const
+  {
+    for (size_t i = 0; i < blocks_.size(); i++)
+    {
+      if (blocks_[i]->holds(node))
+      {
+        return blocks_[i];
+      }
+    }
+    return NULL;
+  }
 
-  static AvlNode<T> *clone(const AvlNode<T> *other, AvlNode<T> *parent = NULL)
+  /**
+   * @brief take over a reference to the block of a node linked into this tree
+   * @note A node behind an incremental compaction cycle is copied out instead, since the cycle releases every other block when over
+   *
+   * @return AvlNode<T, Key, Augment>* the node to link
+   */
+  AvlNode<T, Key, Augment> *adopt(AvlNode<T, Key, Augment> *node, avl::_node_block *block)
   {
-    if (!other)
+    if (compact_block_ && compact_started_ && !(compact_key_ < node->key_) && block->memory != compact_block_)
     {
-      return NULL;
+      AvlNode<T, Key, Augment> *copy = new AvlNode<T, Key, Augment>(node->key_, node->data, NULL);
+      node->~AvlNode<T, Key, Augment>();
+      block->release();
+      _AVL_TELEMETRY(telemetry_.allocations++);
+      return copy;
+    }
+    if (std::find(blocks_.begin(), blocks_.end(), block) == blocks_.end())
+    {
+      blocks_.push_back(block);
+    }
+    else
+    {
+      block->release();
     }
-    return new AvlNode<T>(*other, parent);
+    return node;
   }
-};
 
-template <class T>
-class AvlTree
-{
-public:
-  AvlTree() : root_(NULL), count_(0){};
-  virtual ~AvlTree()
+  static void clear(AvlNode<T, Key, Augment> *node)
   {
-    clear();
+    if (!node)
+    {
+      return;
+    }
+    AvlTree::clear(node->child_[0]);
+    AvlTree::clear(node->child_[1]);
+    destroy(node);
+  }
+
+  /**
+   * @brief free a node, a node of a clone block is only destructed, the block is released by clear
+   */
+  static void destroy(AvlNode<T, Key, Augment> *node)
+  {
+    if (node->pooled_)
+    {
+      node->~AvlNode<T, Key, Augment>();
+    }
+    else
+    {
+      delete node;
+    }
   }
 
-  AvlTree(const AvlTree<T> &other) : root_(other.root_), count_(other.count_), max_key_(other.max_key_), min_key_(other.min_key_)
+  /**
+   * @brief a subtree copied on its own by a clone thread
+   */
+  struct clone_task
   {
-    root_ = AvlNode<T>::clone(other.root_);
-  }
+    const AvlNode<T, Key, Augment> *source;
+    AvlNode<T, Key, Augment> *parent;
+    int dir;
+    AvlNode<T, Key, Augment> *at;
+    size_t size;
+  };
+
+  static const size_t parallel_clone_nodes = 1 << 15;
 
-  AvlTree<T> *clone() const
+  /**
+   * @brief replace the empty content of this tree by a copy of the other tree in a new node block
+   */
+  void copy(const AvlTree<T, Key, Augment, Balance> &other, avl::clone_layout layout, unsigned threads)
   {
-    return new AvlTree<T>(this);
+    count_ = other.count_;
+    tombstones_ = other.tombstones_;
+    compaction_ratio_ = other.compaction_ratio_;
+    max_key_ = other.max_key_;
+    min_key_ = other.min_key_;
+
+    const size_t nodes = other.count_ + other.tombstones_;
+    if (!nodes)
+    {
+      root_ = NULL;
+      return;
+    }
+    blocks_.push_back(new avl::_node_block(nodes * sizeof(AvlNode<T, Key, Augment>)));
+    AvlNode<T, Key, Augment> *block = static_cast<AvlNode<T, Key, Augment> *>(blocks_.back()->memory);
+    _AVL_TELEMETRY(telemetry_.allocations += nodes);
+
+    if (!threads)
+    {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    root_ = threads > 1 && nodes >= parallel_clone_nodes ? copy_parallel(other.root_, block, layout, threads) : copy_subtree(other.root_, NULL, 0, block, layout);
+    AvlNode<T, Key, Augment>::thread_slot::thread(root_);
   }
 
-  AvlTree<T> &operator=(const AvlTree<T> &other)
+  /**
+   * @brief copy a subtree from the given position of the block on, linking it under the parent
+   */
+  static AvlNode<T, Key, Augment> *copy_subtree(const AvlNode<T, Key, Augment> *source, AvlNode<T, Key, Augment> *parent, int dir, AvlNode<T, Key, Augment> *at, avl::clone_layout layout)
   {
-    // Avoid self assignment
-    if (this != &other)
+    AvlNode<T, Key, Augment> *root;
+    if (layout == avl::veb_layout)
     {
-      clear();
-      root_ = AvlNode<T>::clone(other.root_);
-      count_ = other.count_;
-      max_key_ = other.max_key_;
-      min_key_ = other.min_key_;
+      std::vector<clone_task> none;
+      root = at;
+      copy_veb(source, parent, dir, source->height_, at, none);
     }
-    return *this;
+    else
+    {
+      root = copy_inorder(source, parent, at);
+    }
+    if (parent)
+    {
+      parent->child_[dir] = root;
+    }
+    return root;
   }
 
   /**
-   * @brief check whether this tree is equal to the specified one using inorder traversal
-   *
-   * for example, the following balanced trees have the same inorder traversal:
-   *
-   *    2      1
-   *   /        \
-   *  1          2
+   * @brief copy a subtree in ascending key order
    *
-   * @param other tree to compare with
-   * @return true if this tree is equivalent to the specified one
-   * @return false if this tree is different from the specified one
+   * @param next next free node of the block, advanced past the copy
    */
-  bool operator==(const AvlTree<T> &other) const
+  static AvlNode<T, Key, Augment> *copy_inorder(const AvlNode<T, Key, Augment> *source, AvlNode<T, Key, Augment> *parent, AvlNode<T, Key, Augment> *&next)
   {
-    if (!root_ || !other.root_)
+    if (!source)
     {
-      return root_ == other.root_;
+      return NULL;
     }
-    AvlNode<T> *this_node = root_->min_left();
-    AvlNode<T> *other_node = other.root_->min_left();
-    while (this_node && other_node && *this_node == *other_node)
+    AvlNode<T, Key, Augment> *left = copy_inorder(source->child_[0], NULL, next);
+    AvlNode<T, Key, Augment> *node = new (next++) AvlNode<T, Key, Augment>(*source, parent, avl::_pooled());
+    node->child_[0] = left;
+    if (left)
     {
-      this_node = this_node->next();
-      other_node = other_node->next();
+      left->parent_ = node;
     }
-    return !this_node && !other_node;
+    node->child_[1] = copy_inorder(source->child_[1], node, next);
+    return node;
   }
 
-  bool operator!=(const AvlTree<T> &other) const
+  /**
+   * @brief copy the top levels of a subtree in van Emde Boas order: the upper half of the levels first, then every subtree below it
+   *
+   * @param levels number of levels to copy
+   * @param next next free node of the block, advanced past the copy
+   * @param frontier receives the children right below the copied levels, in ascending key order
+   */
+  static void copy_veb(const AvlNode<T, Key, Augment> *source, AvlNode<T, Key, Augment> *parent, int dir, int levels, AvlNode<T, Key, Augment> *&next, std::vector<clone_task> &frontier)
   {
-    return !(*this == other);
-  }
+    if (levels == 1)
+    {
+      AvlNode<T, Key, Augment> *node = new (next++) AvlNode<T, Key, Augment>(*source, parent, avl::_pooled());
+      if (parent)
+      {
+        parent->child_[dir] = node;
+      }
+      for (int child = 0; child < 2; child++)
+      {
+        if (source->child_[child])
+        {
+          const clone_task task = {source->child_[child], node, child, NULL, 0};
+          frontier.push_back(task);
+        }
+      }
+      return;
+    }
 
-  void clear()
-  {
-    AvlTree::clear(root_);
-    root_ = NULL;
+    std::vector<clone_task> middle;
+    copy_veb(source, parent, dir, levels / 2, next, middle);
+    for (size_t i = 0; i < middle.size(); i++)
+    {
+      copy_veb(middle[i].source, middle[i].parent, middle[i].dir, levels - levels / 2, next, frontier);
+    }
   }
 
-  bool empty() const
+  /**
+   * @brief collect the subtrees rooted at the split depth, in ascending key order
+   */
+  static void frontier(const AvlNode<T, Key, Augment> *source, int depth, int split, std::vector<clone_task> &tasks)
   {
-    return count() == 0;
+    for (int child = 0; child < 2; child++)
+    {
+      if (!source->child_[child])
+      {
+        continue;
+      }
+      if (depth + 1 == split)
+      {
+        const clone_task task = {source->child_[child], NULL, child, NULL, 0};
+        tasks.push_back(task);
+      }
+      else
+      {
+        frontier(source->child_[child], depth + 1, split, tasks);
+      }
+    }
   }
 
-  int count() const
+  /**
+   * @brief copy the nodes above the split depth in ascending key order, reserving the room of every frontier subtree in between
+   */
+  static AvlNode<T, Key, Augment> *copy_inorder_top(const AvlNode<T, Key, Augment> *source, int depth, int split, AvlNode<T, Key, Augment> *&next, clone_task *&task)
   {
-    return count_;
-  }
+    AvlNode<T, Key, Augment> *left = NULL;
+    clone_task *left_task = NULL;
+    if (source->child_[0])
+    {
+      if (depth + 1 == split)
+      {
+        left_task = task++;
+        left_task->at = next;
+        next += left_task->size;
+      }
+      else
+      {
+        left = copy_inorder_top(source->child_[0], depth + 1, split, next, task);
+      }
+    }
 
-  int height() const
-  {
-    return root_ ? root_->height() : 0;
-  }
+    AvlNode<T, Key, Augment> *node = new (next++) AvlNode<T, Key, Augment>(*source, NULL, avl::_pooled());
+    if (left)
+    {
+      node->child_[0] = left;
+      left->parent_ = node;
+    }
+    if (left_task)
+    {
+      left_task->parent = node;
+    }
 
-  AvlNode<T> *insert(int key, const T &data = {})
-  {
-    bool inserted = false;
-    AvlNode<T> *inserted_node;
-    root_ = insert(NULL, root_, key, data, inserted, &inserted_node);
-    if (inserted)
+    if (source->child_[1])
     {
-      count_++;
-      if (!max_key_ || max_key_ < inserted_node->key())
+      if (depth + 1 == split)
       {
-        max_key_ = inserted_node->key();
+        task->parent = node;
+        task->at = next;
+        next += task->size;
+        task++;
       }
-      if (!min_key_ || min_key_ > inserted_node->key())
+      else
       {
-        min_key_ = inserted_node->key();
+        node->child_[1] = copy_inorder_top(source->child_[1], depth + 1, split, next, task);
+        node->child_[1]->parent_ = node;
       }
     }
-    return inserted_node;
+    return node;
   }
 
-  AvlNode<T> *root() const
+  /**
+   * @brief an in-order piece of a parallel walk, either a whole subtree or a single node above the subtrees
+   */
+  struct walk_piece
   {
-    return root_;
+    AvlNode<T, Key, Augment> *node;
+    bool subtree;
+  };
+
+  /**
+   * @brief split the tree into subtrees of the grain height at most, and the nodes above them, in ascending key order
+   */
+  static void pieces(AvlNode<T, Key, Augment> *node, int grain_height, std::vector<walk_piece> &pieces)
+  {
+    if (!node)
+    {
+      return;
+    }
+    if (node->height_ <= grain_height)
+    {
+      const walk_piece piece = {node, true};
+      pieces.push_back(piece);
+      return;
+    }
+    AvlTree::pieces(node->child_[0], grain_height, pieces);
+    const walk_piece piece = {node, false};
+    pieces.push_back(piece);
+    AvlTree::pieces(node->child_[1], grain_height, pieces);
   }
 
-  AvlNode<T> *min_left() const
+  static int grain_height(size_t grain)
   {
-    return root_ ? root_->min_left() : NULL;
+    int height = 1;
+    for (; grain > 1; grain >>= 1)
+    {
+      height++;
+    }
+    return height;
   }
 
-  AvlNode<T> *max_right() const
+  template <class Visitor>
+  static void for_each(AvlNode<T, Key, Augment> *node, bool subtree, Visitor &visit)
   {
-    return root_ ? root_->max_right() : NULL;
+    if (!node)
+    {
+      return;
+    }
+    if (subtree)
+    {
+      for_each(node->child_[0], true, visit);
+    }
+    if (!node->tombstone_)
+    {
+      visit(static_cast<const Key &>(node->key_), node->data);
+    }
+    if (subtree)
+    {
+      for_each(node->child_[1], true, visit);
+    }
   }
 
-  int min_key() const
+  /**
+   * @brief recompute heights and aggregates of a subtree bottom up
+   */
+  static void recompute(AvlNode<T, Key, Augment> *node, int grain_height)
   {
-    return min_key_;
+    if (node && node->height_ > grain_height)
+    {
+      recompute(node->child_[0], grain_height);
+      recompute(node->child_[1], grain_height);
+      node->update_height();
+    }
   }
 
-  int max_key() const
+  static size_t size_of(const AvlNode<T, Key, Augment> *node)
   {
-    return max_key_;
+    return node ? 1 + size_of(node->child_[0]) + size_of(node->child_[1]) : 0;
   }
 
-  bool remove(int key, T *removed_data = NULL)
+  /**
+   * @brief run the work on every task, idle threads pick the next pending task from a shared counter
+   */
+  template <class Task, class Work>
+  static void for_each_task(std::vector<Task> &tasks, unsigned threads, Work work)
   {
-    bool removed = false;
-    root_ = remove(root_, key, removed, removed_data);
-    if (removed)
+    if (!threads)
     {
-      count_--;
-      min_key_ = root_ ? root_->min_key() : 0;
-      max_key_ = root_ ? root_->max_key() : 0;
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = unsigned(std::min<size_t>(threads, tasks.size()));
+    std::atomic<size_t> pending(0);
+    const auto worker = [&tasks, &pending, &work]()
+    {
+      for (size_t i = pending++; i < tasks.size(); i = pending++)
+      {
+        work(tasks[i]);
+      }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++)
+    {
+      pool.push_back(std::thread(worker));
+    }
+    worker();
+    for (size_t i = 0; i < pool.size(); i++)
+    {
+      pool[i].join();
     }
-    return removed;
   }
 
-  AvlNode<T> *lookup(int key) const
+  /**
+   * @brief copy the levels above half the height serially, then the subtrees below them on several threads
+   */
+  static AvlNode<T, Key, Augment> *copy_parallel(const AvlNode<T, Key, Augment> *source, AvlNode<T, Key, Augment> *block, avl::clone_layout layout, unsigned threads)
   {
-    return AvlTree::lookup(root_, key);
-  }
+    const int split = source->height_ / 2;
+    std::vector<clone_task> tasks;
+    AvlNode<T, Key, Augment> *next = block;
+    AvlNode<T, Key, Augment> *root = block;
 
-private:
-  AvlNode<T> *root_ = NULL;
-  int count_ = 0;
-  int max_key_ = 0;
-  int min_key_ = 0;
+    if (layout == avl::veb_layout)
+    {
+      copy_veb(source, NULL, 0, split, next, tasks);
+    }
+    else
+    {
+      frontier(source, 0, split, tasks);
+    }
 
-  static void clear(AvlNode<T> *node)
-  {
-    if (!node)
+    // the room of every subtree follows from the sizes of the subtrees before it
+    for_each_task(tasks, threads, [](clone_task &task)
+                  { task.size = size_of(task.source); });
+
+    if (layout == avl::veb_layout)
     {
-      return;
+      for (size_t i = 0; i < tasks.size(); i++)
+      {
+        tasks[i].at = next;
+        next += tasks[i].size;
+      }
+    }
+    else
+    {
+      clone_task *task = tasks.empty() ? NULL : &tasks[0];
+      root = copy_inorder_top(source, 0, split, next, task);
     }
-    AvlTree::clear(node->left_);
-    AvlTree::clear(node->right_);
-    delete node;
+
+    for_each_task(tasks, threads, [layout](clone_task &task)
+                  { copy_subtree(task.source, task.parent, task.dir, task.at, layout); });
+    return root;
   }
 
   /**
@@ -443,14 +3199,14 @@ private:
    * N2 right          right  N1
    *
    * @param node branch root
-   * @return AvlNode<T>* new branch root, node's left
+   * @return AvlNode<T, Key, Augment>* new branch root, node's left
    */
-  static AvlNode<T> *rotate_right(AvlNode<T> *node)
+  static AvlNode<T, Key, Augment> *rotate_right(AvlNode<T, Key, Augment> *node)
   {
-    AvlNode<T> *left = node->left_;
-    AvlNode<T> *right = left->right_;
+    AvlNode<T, Key, Augment> *left = node->child_[0];
+    AvlNode<T, Key, Augment> *right = left->child_[1];
 
-    node->left_ = right;
+    node->child_[0] = right;
 
     if (right)
     {
@@ -458,7 +3214,7 @@ private:
     }
     left->parent_ = node->parent_;
 
-    left->right_ = node;
+    left->child_[1] = node;
     node->parent_ = left;
 
     node->update_height();
@@ -479,14 +3235,14 @@ private:
    *   left   N2    N1   left
 
    * @param node branch root
-   * @return AvlNode<T>* new branch root, node's right
+   * @return AvlNode<T, Key, Augment>* new branch root, node's right
    */
-  static AvlNode<T> *rotate_left(AvlNode<T> *node)
+  static AvlNode<T, Key, Augment> *rotate_left(AvlNode<T, Key, Augment> *node)
   {
-    AvlNode<T> *right = node->right_;
-    AvlNode<T> *left = right->left_;
+    AvlNode<T, Key, Augment> *right = node->child_[1];
+    AvlNode<T, Key, Augment> *left = right->child_[0];
 
-    node->right_ = left;
+    node->child_[1] = left;
 
     if (left)
     {
@@ -494,7 +3250,7 @@ private:
     }
     right->parent_ = node->parent_;
 
-    right->left_ = node;
+    right->child_[0] = node;
     node->parent_ = right;
 
     node->update_height();
@@ -504,196 +3260,153 @@ private:
   }
 
   /**
-   * @brief
-   * @note The time required is O(log n) for lookup, plus a maximum of O(log n) retracing levels (O(1) on average) on the way back to the root,
+   * @brief link a new leaf and let the balancing policy restore its invariant
+   * @note The time required is O(log n) for lookup, plus a maximum of O(log n) retracing levels on the way back to the root,
    *  so the operation can be completed in O(log n) time.
    *
-   * @param parent
-   * @param node
    * @param key
    * @param data
-   * @param inserted
-   * @param inserted_node
-   * @return AvlNode<T>*
+   * @param inserted set when a new node is linked
+   * @return AvlNode<T, Key, Augment>* the new node, or the existing node holding the key
    */
-  AvlNode<T> *insert(AvlNode<T> *parent, AvlNode<T> *node, int key, const T &data, bool &inserted, AvlNode<T> **inserted_node = NULL)
+  AvlNode<T, Key, Augment> *insert(const Key &key, const T &data, bool &inserted)
   {
-    if (!node)
-    {
-      node = new AvlNode<T>(key, data, parent);
-      inserted = true;
-      if (inserted_node)
-      {
-        *inserted_node = node;
-      }
-      return node;
-    }
-    else if (key < node->key_)
-    {
-      node->left_ = insert(node, node->left_, key, data, inserted, inserted_node);
-    }
-    else if (key > node->key_)
-    {
-      node->right_ = insert(node, node->right_, key, data, inserted, inserted_node);
-    }
-    else
+    AvlNode<T, Key, Augment> *parent = NULL;
+    int dir = 0;
+    for (AvlNode<T, Key, Augment> *node = root_; node; node = node->child_[dir])
     {
-      if (inserted_node)
+      _AVL_TELEMETRY(telemetry_.comparisons[AvlTelemetry::op_insert]++);
+      const int compare = avl::_key_compare<Key>::compare(key, node->key_);
+      if (!compare)
       {
-        *inserted_node = node;
+        return node;
       }
-      return node;
+      parent = node;
+      dir = compare > 0;
     }
 
-    node->update_height();
-
-    int balance = node->balance();
+    AvlNode<T, Key, Augment> *node = new AvlNode<T, Key, Augment>(key, data, parent);
+    _AVL_TELEMETRY(telemetry_.allocations++);
+    inserted = true;
+    link(node, parent, dir);
+    return node;
+  }
 
-    if (balance > 1)
+  /**
+   * @brief link a leaf under the parent, or as the root, and let the balancing policy restore its invariant
+   */
+  void link(AvlNode<T, Key, Augment> *node, AvlNode<T, Key, Augment> *parent, int dir)
+  {
+    node->parent_ = parent;
+    if (parent)
     {
-      if (key > node->left_->key_)
-      {
-        node->left_ = rotate_left(node->left_);
-      }
-      node = rotate_right(node);
+      parent->child_[dir] = node;
+      AvlNode<T, Key, Augment>::thread_slot::splice(node, parent, dir);
     }
-
-    if (balance < -1)
+    else
     {
-      if (key < node->right_->key_)
-      {
-        node->right_ = rotate_right(node->right_);
-      }
-      node = rotate_left(node);
+      root_ = node;
     }
 
-    return node;
+    Balance::inserted(*this, node);
   }
 
   /**
-   * @brief
-   * @note The time required is O(log n) for lookup, plus a maximum of O(log n) retracing levels (O(1) on average) on the way back to the root,
-   *  so the operation can be completed in O(log n) time.
+   * @brief unlink the node and let the balancing policy restore its invariant
+   * @note The time required is O(log n) for the successor, plus a maximum of O(log n) retracing levels on the way back to the root.
+   *  The node is unlinked rather than overwritten: a node with two children is replaced by relinking its inorder successor,
+   *  so no payload is copied and every other node keeps its address.
    *
-   * @param node
-   * @param key
-   * @param removed
-   * @param removed_data
-   * @return AvlNode<T>*
+   * @param node node to unlink, the caller owns it afterwards
    */
-  AvlNode<T> *remove(AvlNode<T> *node, int key, bool &removed, T *removed_data = NULL)
+  void unlink(AvlNode<T, Key, Augment> *node)
   {
-    if (!node)
-    {
-      return NULL;
-    }
+    AvlNode<T, Key, Augment> *parent;
+    int dir;
+    unsigned char removed_rank;
 
-    if (key < node->key_)
-    {
-      node->left_ = remove(node->left_, key, removed, removed_data);
-    }
-    else if (key > node->key_)
-    {
-      node->right_ = remove(node->right_, key, removed, removed_data);
-    }
-    else
+    if (node->child_[0] && node->child_[1])
     {
-      if (node->left_ && node->right_)
+      // the successor takes the node place and rank, its own position is the one removed
+      AvlNode<T, Key, Augment> *next = node->child_[1]->min_left();
+      AvlNode<T, Key, Augment> *replacement = next->child_[1];
+      removed_rank = next->rank_;
+      if (next->parent_ == node)
       {
-        AvlNode<T> *alt = node->right_->min_left();
-        if (removed_data)
-        {
-          *removed_data = node->data;
-        }
-        node->key_ = alt->key_;
-        node->data = alt->data;
-        node->right_ = remove(node->right_, alt->key_, removed, NULL);
+        parent = next;
+        dir = 1;
       }
       else
       {
-        AvlNode<T> *alt = node;
-
-        if (removed_data)
-        {
-          *removed_data = node->data;
-        }
-
-        if (alt->left_)
-        {
-          alt = alt->left_;
-        }
-        else
-        {
-          alt = alt->right_;
-        }
-
-        if (alt)
+        parent = next->parent_;
+        dir = 0;
+        parent->child_[0] = replacement;
+        if (replacement)
         {
-          *node = *alt;
+          replacement->parent_ = parent;
         }
-        else
-        {
-          alt = node;
-          node = NULL;
-        }
-
-        delete alt;
+        next->child_[1] = node->child_[1];
+        next->child_[1]->parent_ = next;
       }
-
-      removed = true;
-    }
-    if (!node)
-    {
-      return NULL;
-    }
-
-    node->update_height();
-
-    int balance = node->balance();
-
-    if (balance > 1)
-    {
-      if (node->left_->balance() < 0)
-      {
-        node->left_ = rotate_left(node->left_);
-      }
-      node = rotate_right(node);
+      next->child_[0] = node->child_[0];
+      next->child_[0]->parent_ = next;
+      next->rank_ = node->rank_;
+      next->height_ = node->height_;
+      transplant(node, next);
     }
-
-    if (balance < -1)
+    else
     {
-      if (node->right_->balance() > 0)
-      {
-        node->right_ = rotate_right(node->right_);
-      }
-      node = rotate_left(node);
+      parent = node->parent_;
+      dir = parent && parent->child_[1] == node;
+      removed_rank = node->rank_;
+      transplant(node, node->child_[0] ? node->child_[0] : node->child_[1]);
     }
 
-    return node;
+    node->parent_ = node->child_[0] = node->child_[1] = NULL;
+    AvlNode<T, Key, Augment>::thread_slot::unsplice(node, node);
+    Balance::removed(*this, parent, dir, removed_rank);
   }
 
   /**
    * @brief searching for a specific key
-   * @note search is limited by the height h, unsuccessful search is very close to h, so both cases requires O(log n)
+   * @note search is limited by the height h, unsuccessful search is very close to h, so both cases requires O(log n).
+   *  Every level takes a single three-way comparison and selects the child by index, so integral keys descend without branching on the key order
    *
    * @param node
    * @param key
-   * @return AvlNode<T>*
+   * @return AvlNode<T, Key, Augment>*
    */
-  static AvlNode<T> *
-  lookup(AvlNode<T> *node, int key)
+  AvlNode<T, Key, Augment> *
+  lookup(AvlNode<T, Key, Augment> *node, const Key &key) const
   {
-    if (!node)
-    {
-      return NULL;
-    }
-    if (key < node->key_)
+    while (node)
     {
-      return AvlTree::lookup(node->left_, key);
+      _AVL_TELEMETRY(telemetry_.comparisons[AvlTelemetry::op_lookup]++);
+      const int compare = avl::_key_compare<Key>::compare(key, node->key_);
+      if (!compare)
+      {
+        break;
+      }
+      node = node->child_[compare > 0];
     }
-    if (key > node->key_)
+    return node;
+  }
+
+  /**
+   * @brief lookup within the subtree of node, keeping the last node visited
+   */
+  AvlNode<T, Key, Augment> *descend(AvlNode<T, Key, Augment> *node, const Key &key, AvlNode<T, Key, Augment> *&last) const
+  {
+    while (node)
     {
-      return AvlTree::lookup(node->right_, key);
+      last = node;
+      _AVL_TELEMETRY(telemetry_.comparisons[AvlTelemetry::op_lookup]++);
+      const int compare = avl::_key_compare<Key>::compare(key, node->key_);
+      if (!compare)
+      {
+        break;
+      }
+      node = node->child_[compare > 0];
     }
     return node;
   }
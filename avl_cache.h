@@ -0,0 +1,184 @@
+/**
+ * @file avl_cache.h
+ * @author Moshe Pontch (pontch at gmail.com)
+ * @brief Hot key cache in front of the AVL tree lookup
+ * @version 1.0
+ * @date 2022-08-31
+ *
+ */
+#ifndef _AVL_CACHE__H
+#define _AVL_CACHE__H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "avl.h"
+
+/**
+ * @brief AVL tree with a small set associative cache of key to node, checked before every lookup
+ *
+ * every set holds a few keys in the order of their recent hits: a hit moves its key one way up, a miss found in the tree
+ * replaces the last way, so popular keys settle in the first ways while keys seen once only churn the last one.
+ * Nodes keep their address in the tree, so a cached node stays valid until its key is removed, which invalidates it.
+ * The tree is only exposed as const since compact and purge relocate nodes behind the cache.
+ * lookup reorders the cache and counts hits, so it is not const: concurrent lookups need external synchronization,
+ * or lookups of tree() which bypass the cache.
+ * The cache takes sets * ways entries of a key and a pointer
+ */
+template <class T, class Key = int, class Augment = avl::no_augment, class Balance = avl::avl_balance>
+class AvlCachedTree
+{
+public:
+  typedef AvlTree<T, Key, Augment, Balance> tree_type;
+  typedef typename tree_type::node_type node_type;
+
+  static const size_t ways = 4;
+
+  /**
+   * @param entries number of cached keys, rounded up to a power of two sets of ways keys
+   */
+  explicit AvlCachedTree(size_t entries = 4096) : bits_(0), hits_(0), misses_(0)
+  {
+    while ((ways << bits_) < entries)
+    {
+      bits_++;
+    }
+    cache_.resize(ways << bits_);
+  }
+
+  AvlCachedTree(const AvlCachedTree<T, Key, Augment, Balance> &other) : tree_(other.tree_), cache_(other.cache_.size()), bits_(other.bits_), hits_(0), misses_(0) {}
+
+  AvlCachedTree<T, Key, Augment, Balance> &operator=(const AvlCachedTree<T, Key, Augment, Balance> &other)
+  {
+    if (this != &other)
+    {
+      tree_ = other.tree_;
+      cache_.assign(other.cache_.size(), entry());
+      bits_ = other.bits_;
+    }
+    return *this;
+  }
+
+  const tree_type &tree() const
+  {
+    return tree_;
+  }
+
+  bool empty() const
+  {
+    return tree_.empty();
+  }
+
+  int count() const
+  {
+    return tree_.count();
+  }
+
+  void clear()
+  {
+    tree_.clear();
+    invalidate();
+  }
+
+  node_type *insert(const Key &key, const T &data = {})
+  {
+    return tree_.insert(key, data);
+  }
+
+  bool remove(const Key &key, T *removed_data = NULL)
+  {
+    entry *set = set_of(key);
+    for (size_t way = 0; way < ways; way++)
+    {
+      if (set[way].node && !(set[way].key < key) && !(key < set[way].key))
+      {
+        set[way].node = NULL;
+      }
+    }
+    return tree_.remove(key, removed_data);
+  }
+
+  /**
+   * @brief lookup through the cache, a hit costs a hash and a single set of keys
+   * @note The time complexity is O(1) for a hit, O(log n) otherwise
+   *
+   * @return node_type* NULL if the key is missing
+   */
+  node_type *lookup(const Key &key)
+  {
+    entry *set = set_of(key);
+    for (size_t way = 0; way < ways; way++)
+    {
+      if (set[way].node && !(set[way].key < key) && !(key < set[way].key))
+      {
+        hits_++;
+        node_type *node = set[way].node;
+        if (way)
+        {
+          std::swap(set[way], set[way - 1]);
+        }
+        return node;
+      }
+    }
+
+    misses_++;
+    node_type *node = tree_.lookup(key);
+    if (node)
+    {
+      set[ways - 1].key = key;
+      set[ways - 1].node = node;
+    }
+    return node;
+  }
+
+  /**
+   * @brief forget every cached key, the counters are kept
+   */
+  void invalidate()
+  {
+    cache_.assign(cache_.size(), entry());
+  }
+
+  unsigned long long hits() const
+  {
+    return hits_;
+  }
+
+  unsigned long long misses() const
+  {
+    return misses_;
+  }
+
+  void reset_counters()
+  {
+    hits_ = misses_ = 0;
+  }
+
+private:
+  struct entry
+  {
+    Key key;
+    node_type *node;
+
+    entry() : key(), node(NULL) {}
+  };
+
+  tree_type tree_;
+  std::vector<entry> cache_;
+  int bits_;
+  unsigned long long hits_;
+  unsigned long long misses_;
+
+  /**
+   * @brief the set of a key, by multiplicative hashing since std::hash of integers is often the identity
+   */
+  entry *set_of(const Key &key)
+  {
+    const uint64_t hash = uint64_t(std::hash<Key>()(key)) * 0x9e3779b97f4a7c15ULL;
+    return &cache_[bits_ ? (hash >> (64 - bits_)) * ways : 0];
+  }
+};
+
+#endif // _AVL_CACHE__H
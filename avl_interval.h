@@ -0,0 +1,238 @@
+/**
+ * @file avl_interval.h
+ * @author Moshe Pontch (pontch at gmail.com)
+ * @brief Interval tree on top of the AVL tree
+ * @version 1.0
+ * @date 2022-08-31
+ *
+ */
+#ifndef _AVL_INTERVAL__H
+#define _AVL_INTERVAL__H
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "avl.h"
+
+/**
+ * @brief closed interval [start, end] and its value
+ */
+template <class T, class Key = int>
+struct AvlInterval
+{
+  Key start;
+  Key end;
+  T value;
+};
+
+namespace avl
+{
+  /**
+   * @brief intervals sharing the same start, ordered by descending end
+   */
+  template <class T, class Key>
+  struct _interval_bucket
+  {
+    struct entry
+    {
+      Key end;
+      T value;
+    };
+
+    std::vector<entry> entries;
+  };
+
+  /**
+   * @brief keeps the maximal interval end of every subtree
+   */
+  template <class T, class Key>
+  struct _interval_augment
+  {
+    typedef Key value_type;
+    static value_type identity() { return std::numeric_limits<Key>::lowest(); }
+    static value_type lift(const Key &, const _interval_bucket<T, Key> &bucket) { return bucket.entries.empty() ? identity() : bucket.entries.front().end; }
+    static value_type combine(const value_type &left, const value_type &right) { return left < right ? right : left; }
+  };
+} // namespace avl
+
+/**
+ * @brief interval tree keyed by interval start, every node keeps the maximal end in its subtree
+ *
+ * overlap and stabbing queries skip any subtree whose maximal end precedes the query, so each reported interval
+ * costs at most a root to leaf path: k reported intervals take O(min(n, (k + 1) log n)), not O(log n + k)
+ */
+template <class T, class Key = int>
+class AvlIntervalTree
+{
+public:
+  typedef AvlInterval<T, Key> interval_type;
+  typedef avl::_interval_bucket<T, Key> bucket_type;
+  typedef AvlTree<bucket_type, Key, avl::_interval_augment<T, Key>> tree_type;
+
+  AvlIntervalTree() : count_(0){};
+
+  void clear()
+  {
+    tree_.clear();
+    count_ = 0;
+  }
+
+  bool empty() const
+  {
+    return count() == 0;
+  }
+
+  int count() const
+  {
+    return count_;
+  }
+
+  const tree_type &tree() const
+  {
+    return tree_;
+  }
+
+  /**
+   * @brief insert the closed interval [start, end], intervals may repeat and share their start
+   * @note The time complexity is O(log n) plus the number of intervals sharing the same start
+   *
+   * @return false if end precedes start
+   */
+  bool insert(const Key &start, const Key &end, const T &value = {})
+  {
+    if (end < start)
+    {
+      return false;
+    }
+
+    const typename bucket_type::entry item = {end, value};
+    typename tree_type::node_type *node = tree_.lookup(start);
+    if (node)
+    {
+      std::vector<typename bucket_type::entry> &entries = node->data.entries;
+      entries.insert(std::upper_bound(entries.begin(), entries.end(), item, later_end), item);
+      tree_.refresh(node);
+    }
+    else
+    {
+      bucket_type bucket;
+      bucket.entries.push_back(item);
+      tree_.insert(start, bucket);
+    }
+    count_++;
+    return true;
+  }
+
+  /**
+   * @brief remove a single occurrence of the closed interval [start, end]
+   *
+   * @param removed_value optionally receives the value of the removed interval
+   * @return true if such an interval was found
+   */
+  bool remove(const Key &start, const Key &end, T *removed_value = NULL)
+  {
+    typename tree_type::node_type *node = tree_.lookup(start);
+    if (!node)
+    {
+      return false;
+    }
+
+    std::vector<typename bucket_type::entry> &entries = node->data.entries;
+    const typename bucket_type::entry item = {end, T()};
+    typename std::vector<typename bucket_type::entry>::iterator it = std::lower_bound(entries.begin(), entries.end(), item, later_end);
+    if (it == entries.end() || it->end < end)
+    {
+      return false;
+    }
+
+    if (removed_value)
+    {
+      *removed_value = it->value;
+    }
+    entries.erase(it);
+    if (entries.empty())
+    {
+      tree_.remove(start);
+    }
+    else
+    {
+      tree_.refresh(node);
+    }
+    count_--;
+    return true;
+  }
+
+  /**
+   * @brief visit every interval overlapping [lo, hi] in ascending start order
+   *
+   * @param visit called as visit(const AvlInterval<T, Key> &)
+   */
+  template <class Visitor>
+  void for_each_overlapping(const Key &lo, const Key &hi, Visitor visit) const
+  {
+    if (!(hi < lo))
+    {
+      overlapping(tree_.root(), lo, hi, visit);
+    }
+  }
+
+  /**
+   * @brief all the intervals overlapping [lo, hi] in ascending start order
+   * @note The time complexity is O(min(n, (k + 1) log n)) for k reported intervals
+   */
+  std::vector<interval_type> overlapping(const Key &lo, const Key &hi) const
+  {
+    std::vector<interval_type> found;
+    for_each_overlapping(lo, hi, [&found](const interval_type &interval)
+                         { found.push_back(interval); });
+    return found;
+  }
+
+  /**
+   * @brief all the intervals containing the point
+   * @note The time complexity is O(min(n, (k + 1) log n)) for k reported intervals
+   */
+  std::vector<interval_type> stabbing(const Key &point) const
+  {
+    return overlapping(point, point);
+  }
+
+private:
+  tree_type tree_;
+  int count_;
+
+  static bool later_end(const typename bucket_type::entry &a, const typename bucket_type::entry &b)
+  {
+    return b.end < a.end;
+  }
+
+  template <class Visitor>
+  static void overlapping(const typename tree_type::node_type *node, const Key &lo, const Key &hi, Visitor &visit)
+  {
+    // no interval in this subtree reaches lo
+    if (!node || node->aggregate() < lo)
+    {
+      return;
+    }
+
+    overlapping(node->left(), lo, hi, visit);
+
+    // this node and its right subtree start after hi
+    if (hi < node->key())
+    {
+      return;
+    }
+
+    for (typename std::vector<typename bucket_type::entry>::const_iterator it = node->data.entries.begin();
+         it != node->data.entries.end() && !(it->end < lo); ++it)
+    {
+      const interval_type interval = {node->key(), it->end, it->value};
+      visit(interval);
+    }
+
+    overlapping(node->right(), lo, hi, visit);
+  }
+};
+
+#endif // _AVL_INTERVAL__H
@@ -0,0 +1,469 @@
+/**
+ * @file avl_lean.h
+ * @author Moshe Pontch (pontch at gmail.com)
+ * @brief Memory lean AVL tree, nodes keep no parent and no height
+ * @version 1.0
+ * @date 2022-08-31
+ *
+ */
+#ifndef _AVL_LEAN__H
+#define _AVL_LEAN__H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "avl.h"
+
+template <class T, class Key>
+class AvlLeanTree;
+
+/**
+ * @brief AVL node holding only its key, data and two child links
+ *
+ * the balance factor lives in the low bit of each child link: the left bit marks a left heavy node
+ * and the right bit a right heavy node, so an int keyed node takes 24 bytes rather than 40
+ */
+template <class T, class Key = int>
+class AvlLeanNode
+{
+  friend class AvlLeanTree<T, Key>;
+
+public:
+  T data;
+
+  AvlLeanNode(const Key &key, const T &data) : data(data), key_(key), child_() {}
+
+  const Key &key() const
+  {
+    return key_;
+  }
+
+  AvlLeanNode<T, Key> *left() const
+  {
+    return child(0);
+  }
+
+  AvlLeanNode<T, Key> *right() const
+  {
+    return child(1);
+  }
+
+  /**
+   * @brief left subtree height minus right subtree height, like AvlNode::balance
+   */
+  int balance() const
+  {
+    return int(child_[0] & 1) - int(child_[1] & 1);
+  }
+
+private:
+  Key key_;
+  // child links, the low bit of each tells whether that side is the taller one
+  uintptr_t child_[2];
+
+  AvlLeanNode<T, Key> *child(int dir) const
+  {
+    return reinterpret_cast<AvlLeanNode<T, Key> *>(child_[dir] & ~uintptr_t(1));
+  }
+
+  void set_child(int dir, AvlLeanNode<T, Key> *node)
+  {
+    child_[dir] = reinterpret_cast<uintptr_t>(node) | (child_[dir] & 1);
+  }
+
+  /**
+   * @brief right subtree height minus left subtree height, the sign retracing and rotations work with
+   */
+  int skew() const
+  {
+    return -balance();
+  }
+
+  void set_skew(int skew)
+  {
+    child_[0] = (child_[0] & ~uintptr_t(1)) | (skew < 0);
+    child_[1] = (child_[1] & ~uintptr_t(1)) | (skew > 0);
+  }
+};
+
+/**
+ * @brief AVL tree of lean nodes, insert, remove and iteration keep the path from the root on an explicit stack
+ *
+ * lookup descends exactly like AvlTree, and every node does without the parent pointer and the height of an AvlNode.
+ * Nodes keep their address until removed
+ */
+template <class T, class Key = int>
+class AvlLeanTree
+{
+public:
+  typedef AvlLeanNode<T, Key> node_type;
+
+  // an AVL tree of height 96 holds more than 2^64 nodes
+  static const int max_height = 96;
+
+  /**
+   * @brief inorder iterator, keeps the path to the current node
+   */
+  class iterator
+  {
+  public:
+    iterator() : depth_(0) {}
+
+    node_type &operator*() const
+    {
+      return *path_[depth_ - 1];
+    }
+
+    node_type *operator->() const
+    {
+      return path_[depth_ - 1];
+    }
+
+    iterator &operator++()
+    {
+      node_type *node = path_[--depth_]->right();
+      descend(node);
+      return *this;
+    }
+
+    bool operator==(const iterator &other) const
+    {
+      return depth_ == other.depth_ && (!depth_ || path_[depth_ - 1] == other.path_[depth_ - 1]);
+    }
+
+    bool operator!=(const iterator &other) const
+    {
+      return !(*this == other);
+    }
+
+  private:
+    friend class AvlLeanTree<T, Key>;
+
+    // the current node and its ancestors still to be visited
+    node_type *path_[max_height];
+    int depth_;
+
+    void descend(node_type *node)
+    {
+      for (; node; node = node->left())
+      {
+        path_[depth_++] = node;
+      }
+    }
+  };
+
+  AvlLeanTree() : root_(NULL), count_(0) {}
+
+  AvlLeanTree(const AvlLeanTree<T, Key> &other) : root_(clone(other.root_)), count_(other.count_) {}
+
+  AvlLeanTree<T, Key> &operator=(const AvlLeanTree<T, Key> &other)
+  {
+    if (this != &other)
+    {
+      clear();
+      root_ = clone(other.root_);
+      count_ = other.count_;
+    }
+    return *this;
+  }
+
+  ~AvlLeanTree()
+  {
+    clear();
+  }
+
+  void clear()
+  {
+    clear(root_);
+    root_ = NULL;
+    count_ = 0;
+  }
+
+  bool empty() const
+  {
+    return count_ == 0;
+  }
+
+  size_t count() const
+  {
+    return count_;
+  }
+
+  node_type *root() const
+  {
+    return root_;
+  }
+
+  /**
+   * @brief tree height, following the taller child from the root
+   * @note The time complexity is O(log n)
+   */
+  int height() const
+  {
+    int height = 0;
+    for (node_type *node = root_; node; node = node->child(node->skew() > 0))
+    {
+      height++;
+    }
+    return height;
+  }
+
+  iterator begin() const
+  {
+    iterator it;
+    it.descend(root_);
+    return it;
+  }
+
+  iterator end() const
+  {
+    return iterator();
+  }
+
+  node_type *lookup(const Key &key) const
+  {
+    node_type *node = root_;
+    while (node)
+    {
+      const int compare = avl::_key_compare<Key>::compare(key, node->key_);
+      if (!compare)
+      {
+        break;
+      }
+      node = node->child(compare > 0);
+    }
+    return node;
+  }
+
+  /**
+   * @brief insert a new node, a duplicate key is ignored
+   * @note The time complexity is O(log n), retracing stops at the first node whose height is unchanged
+   *
+   * @return node_type* the new node, or the existing node holding the key
+   */
+  node_type *insert(const Key &key, const T &data = {})
+  {
+    step path[max_height];
+    int depth = 0;
+    for (node_type *node = root_; node;)
+    {
+      const int compare = avl::_key_compare<Key>::compare(key, node->key_);
+      if (!compare)
+      {
+        return node;
+      }
+      path[depth].node = node;
+      path[depth++].dir = compare > 0;
+      node = node->child(compare > 0);
+    }
+
+    node_type *node = new node_type(key, data);
+    count_++;
+    link(path, depth, node);
+
+    while (depth-- > 0)
+    {
+      node_type *parent = path[depth].node;
+      const int dir = path[depth].dir;
+      const int grown = dir ? 1 : -1;
+      if (!parent->skew())
+      {
+        parent->set_skew(grown);
+      }
+      else if (parent->skew() != grown)
+      {
+        parent->set_skew(0);
+        break;
+      }
+      else
+      {
+        bool shorter;
+        link(path, depth, rotate(parent, dir, shorter));
+        break;
+      }
+    }
+    return node;
+  }
+
+  /**
+   * @brief remove a node, a node with two children is replaced by relinking its inorder successor
+   * @note The time complexity is O(log n)
+   *
+   * @param removed_data optionally receives the data of the removed node
+   * @return true if the key was found
+   */
+  bool remove(const Key &key, T *removed_data = NULL)
+  {
+    step path[max_height];
+    int depth = 0;
+    node_type *node = root_;
+    while (node)
+    {
+      const int compare = avl::_key_compare<Key>::compare(key, node->key_);
+      if (!compare)
+      {
+        break;
+      }
+      path[depth].node = node;
+      path[depth++].dir = compare > 0;
+      node = node->child(compare > 0);
+    }
+    if (!node)
+    {
+      return false;
+    }
+
+    if (node->left() && node->right())
+    {
+      // the successor takes the node place and balance, its own position is the one removed
+      const int place = depth;
+      path[depth].node = node;
+      path[depth++].dir = 1;
+      node_type *next = node->right();
+      while (next->left())
+      {
+        path[depth].node = next;
+        path[depth++].dir = 0;
+        next = next->left();
+      }
+      path[depth - 1].node->set_child(path[depth - 1].dir, next->right());
+      next->child_[0] = node->child_[0];
+      next->child_[1] = node->child_[1];
+      link(path, place, next);
+      path[place].node = next;
+    }
+    else
+    {
+      link(path, depth, node->child(!node->left()));
+    }
+
+    while (depth-- > 0)
+    {
+      node_type *parent = path[depth].node;
+      const int dir = path[depth].dir;
+      const int shrunk = dir ? 1 : -1;
+      if (!parent->skew())
+      {
+        parent->set_skew(-shrunk);
+        break;
+      }
+      else if (parent->skew() == shrunk)
+      {
+        parent->set_skew(0);
+      }
+      else
+      {
+        bool shorter;
+        link(path, depth, rotate(parent, !dir, shorter));
+        if (!shorter)
+        {
+          break;
+        }
+      }
+    }
+
+    if (removed_data)
+    {
+      *removed_data = node->data;
+    }
+    delete node;
+    count_--;
+    return true;
+  }
+
+  /**
+   * @brief visit every node in ascending key order
+   *
+   * @param visit called as visit(const Key &, T &)
+   */
+  template <class Visitor>
+  void for_each(Visitor visit) const
+  {
+    for (iterator it = begin(); it != end(); ++it)
+    {
+      visit(it->key(), it->data);
+    }
+  }
+
+private:
+  struct step
+  {
+    node_type *node;
+    int dir;
+  };
+
+  node_type *root_;
+  size_t count_;
+
+  /**
+   * @brief link the node in place of the child at the given path depth
+   */
+  void link(step *path, int depth, node_type *node)
+  {
+    if (depth)
+    {
+      path[depth - 1].node->set_child(path[depth - 1].dir, node);
+    }
+    else
+    {
+      root_ = node;
+    }
+  }
+
+  /**
+   * @brief rotate a node whose dir side is two levels taller
+   *
+   * @param shorter set when the subtree lost a level, which is always the case after an insert
+   * @return node_type* the new subtree root
+   */
+  static node_type *rotate(node_type *node, int dir, bool &shorter)
+  {
+    const int heavy = dir ? 1 : -1;
+    node_type *child = node->child(dir);
+    if (child->skew() == -heavy)
+    {
+      node_type *grandchild = child->child(!dir);
+      const int skew = grandchild->skew();
+      node->set_child(dir, grandchild->child(!dir));
+      child->set_child(!dir, grandchild->child(dir));
+      grandchild->set_child(!dir, node);
+      grandchild->set_child(dir, child);
+      node->set_skew(skew == heavy ? -heavy : 0);
+      child->set_skew(skew == -heavy ? heavy : 0);
+      grandchild->set_skew(0);
+      shorter = true;
+      return grandchild;
+    }
+
+    node->set_child(dir, child->child(!dir));
+    child->set_child(!dir, node);
+    shorter = child->skew() != 0;
+    node->set_skew(shorter ? 0 : heavy);
+    child->set_skew(shorter ? 0 : -heavy);
+    return child;
+  }
+
+  static void clear(node_type *node)
+  {
+    if (node)
+    {
+      clear(node->left());
+      clear(node->right());
+      delete node;
+    }
+  }
+
+  static node_type *clone(const node_type *other)
+  {
+    if (!other)
+    {
+      return NULL;
+    }
+    node_type *node = new node_type(other->key_, other->data);
+    node->child_[0] = reinterpret_cast<uintptr_t>(clone(other->left())) | (other->child_[0] & 1);
+    node->child_[1] = reinterpret_cast<uintptr_t>(clone(other->right())) | (other->child_[1] & 1);
+    return node;
+  }
+};
+
+#endif // _AVL_LEAN__H
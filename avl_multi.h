@@ -0,0 +1,378 @@
+/**
+ * @file avl_multi.h
+ * @author Moshe Pontch (pontch at gmail.com)
+ * @brief Multiset and multimap on top of the AVL tree
+ * @version 1.0
+ * @date 2022-08-31
+ *
+ */
+#ifndef _AVL_MULTI__H
+#define _AVL_MULTI__H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "avl.h"
+
+namespace avl
+{
+  /**
+   * @brief values sharing a single key, in insertion order
+   * @note the first value is kept inline in the node, repeats are appended to a vector
+   *  growing geometrically, so r repeats cost O(log r) allocations rather than r tree nodes
+   */
+  template <class T>
+  class multi_values
+  {
+  public:
+    class const_iterator
+    {
+    public:
+      const_iterator() : values_(NULL), index_(0) {}
+      const_iterator(const multi_values<T> *values, size_t index) : values_(values), index_(index) {}
+
+      const T &operator*() const
+      {
+        return (*values_)[index_];
+      }
+
+      const T *operator->() const
+      {
+        return &(*values_)[index_];
+      }
+
+      const_iterator &operator++()
+      {
+        index_++;
+        return *this;
+      }
+
+      const_iterator operator++(int)
+      {
+        const_iterator it = *this;
+        index_++;
+        return it;
+      }
+
+      bool operator==(const const_iterator &other) const
+      {
+        return values_ == other.values_ && index_ == other.index_;
+      }
+
+      bool operator!=(const const_iterator &other) const
+      {
+        return !(*this == other);
+      }
+
+    private:
+      const multi_values<T> *values_;
+      size_t index_;
+    };
+
+    multi_values() {}
+    multi_values(const T &first) : first_(first) {}
+
+    size_t size() const
+    {
+      return 1 + rest_.size();
+    }
+
+    const T &operator[](size_t index) const
+    {
+      return index ? rest_[index - 1] : first_;
+    }
+
+    T &operator[](size_t index)
+    {
+      return index ? rest_[index - 1] : first_;
+    }
+
+    const_iterator begin() const
+    {
+      return const_iterator(this, 0);
+    }
+
+    const_iterator end() const
+    {
+      return const_iterator(this, size());
+    }
+
+    void push_back(const T &value)
+    {
+      rest_.push_back(value);
+    }
+
+    /**
+     * @brief drop the last value, a node always keeps its first value
+     */
+    void pop_back()
+    {
+      rest_.pop_back();
+    }
+
+    const T &back() const
+    {
+      return rest_.empty() ? first_ : rest_.back();
+    }
+
+  private:
+    T first_;
+    std::vector<T> rest_;
+  };
+} // namespace avl
+
+/**
+ * @brief ordered multiset, every distinct key is a single tree node holding its multiplicity
+ */
+template <class Key = int>
+class AvlMultiSet
+{
+public:
+  typedef AvlTree<size_t, Key> tree_type;
+  typedef typename tree_type::node_type node_type;
+
+  AvlMultiSet() : size_(0){};
+
+  void clear()
+  {
+    tree_.clear();
+    size_ = 0;
+  }
+
+  bool empty() const
+  {
+    return size_ == 0;
+  }
+
+  /**
+   * @brief number of instances, repeats included
+   */
+  size_t size() const
+  {
+    return size_;
+  }
+
+  /**
+   * @brief number of distinct keys
+   */
+  int distinct() const
+  {
+    return tree_.count();
+  }
+
+  const tree_type &tree() const
+  {
+    return tree_;
+  }
+
+  /**
+   * @brief add copies of the key
+   * @note The time complexity is O(log n) regardless of the number of copies
+   *
+   * @return node_type* the key node, its data is the key multiplicity, NULL when adding no copies of a missing key
+   */
+  node_type *insert(const Key &key, size_t copies = 1)
+  {
+    if (!copies)
+    {
+      return tree_.lookup(key);
+    }
+    node_type *node = tree_.insert(key, 0);
+    node->data += copies;
+    size_ += copies;
+    return node;
+  }
+
+  size_t count(const Key &key) const
+  {
+    const node_type *node = tree_.lookup(key);
+    return node ? node->data : 0;
+  }
+
+  /**
+   * @brief nodes range [first, last) holding the key, empty when the key is missing
+   */
+  std::pair<node_type *, node_type *> equal_range(const Key &key) const
+  {
+    node_type *node = tree_.lookup(key);
+    return std::make_pair(node, node ? node->next() : NULL);
+  }
+
+  /**
+   * @brief remove a single instance of the key
+   *
+   * @return true if the key was found
+   */
+  bool remove(const Key &key)
+  {
+    node_type *node = tree_.lookup(key);
+    if (!node)
+    {
+      return false;
+    }
+    if (--node->data == 0)
+    {
+      tree_.remove(key);
+    }
+    size_--;
+    return true;
+  }
+
+  /**
+   * @brief remove all the instances of the key
+   *
+   * @return size_t the number of removed instances
+   */
+  size_t remove_all(const Key &key)
+  {
+    size_t removed = 0;
+    tree_.remove(key, &removed);
+    size_ -= removed;
+    return removed;
+  }
+
+private:
+  tree_type tree_;
+  size_t size_;
+};
+
+/**
+ * @brief ordered multimap, every distinct key is a single tree node holding all of its values
+ */
+template <class T, class Key = int>
+class AvlMultiMap
+{
+public:
+  typedef avl::multi_values<T> values_type;
+  typedef AvlTree<values_type, Key> tree_type;
+  typedef typename tree_type::node_type node_type;
+  typedef typename values_type::const_iterator const_iterator;
+
+  AvlMultiMap() : size_(0){};
+
+  void clear()
+  {
+    tree_.clear();
+    size_ = 0;
+  }
+
+  bool empty() const
+  {
+    return size_ == 0;
+  }
+
+  /**
+   * @brief number of values, repeated keys included
+   */
+  size_t size() const
+  {
+    return size_;
+  }
+
+  /**
+   * @brief number of distinct keys
+   */
+  int distinct() const
+  {
+    return tree_.count();
+  }
+
+  const tree_type &tree() const
+  {
+    return tree_;
+  }
+
+  /**
+   * @brief add a value to the key, values of the same key are kept in insertion order
+   * @note The time complexity is O(log n), a repeated key creates no tree node
+   *
+   * @return node_type* the key node, its data holds all the key values
+   */
+  node_type *insert(const Key &key, const T &value = {})
+  {
+    node_type *node = tree_.lookup(key);
+    if (node)
+    {
+      node->data.push_back(value);
+    }
+    else
+    {
+      node = tree_.insert(key, values_type(value));
+    }
+    size_++;
+    return node;
+  }
+
+  size_t count(const Key &key) const
+  {
+    const node_type *node = tree_.lookup(key);
+    return node ? node->data.size() : 0;
+  }
+
+  /**
+   * @brief values of the key in insertion order, empty when the key is missing
+   */
+  std::pair<const_iterator, const_iterator> equal_range(const Key &key) const
+  {
+    const node_type *node = tree_.lookup(key);
+    if (!node)
+    {
+      return std::make_pair(const_iterator(), const_iterator());
+    }
+    return std::make_pair(node->data.begin(), node->data.end());
+  }
+
+  /**
+   * @brief remove the last inserted value of the key
+   *
+   * @param removed_data optionally receives the removed value
+   * @return true if the key was found
+   */
+  bool remove(const Key &key, T *removed_data = NULL)
+  {
+    node_type *node = tree_.lookup(key);
+    if (!node)
+    {
+      return false;
+    }
+    if (removed_data)
+    {
+      *removed_data = node->data.back();
+    }
+    if (node->data.size() > 1)
+    {
+      node->data.pop_back();
+    }
+    else
+    {
+      tree_.remove(key);
+    }
+    size_--;
+    return true;
+  }
+
+  /**
+   * @brief remove all the values of the key
+   *
+   * @return size_t the number of removed values
+   */
+  size_t remove_all(const Key &key)
+  {
+    const node_type *node = tree_.lookup(key);
+    if (!node)
+    {
+      return 0;
+    }
+    const size_t removed = node->data.size();
+    tree_.remove(key);
+    size_ -= removed;
+    return removed;
+  }
+
+private:
+  tree_type tree_;
+  size_t size_;
+};
+
+#endif // _AVL_MULTI__H
@@ -0,0 +1,229 @@
+/**
+ * @file avl_quantile.h
+ * @author Moshe Pontch (pontch at gmail.com)
+ * @brief Sliding window quantiles on top of the AVL tree
+ * @version 1.0
+ * @date 2022-08-31
+ *
+ */
+#ifndef _AVL_QUANTILE__H
+#define _AVL_QUANTILE__H
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <deque>
+#include <type_traits>
+#include <utility>
+
+#include "avl.h"
+
+/**
+ * @brief streaming quantiles over the most recent samples
+ *
+ * every distinct sample value is a single tree node holding its multiplicity, and every node keeps the number of samples in its subtree,
+ * so push, eviction, quantile and rank take O(log n) for n distinct values in the window.
+ * Samples leave the window once it holds more than the window size, or once they are older than the window age
+ */
+template <class Key = double>
+class AvlQuantile
+{
+public:
+  typedef std::chrono::steady_clock clock;
+  typedef AvlTree<size_t, Key, avl::sum_augment<size_t>> tree_type;
+  typedef typename tree_type::node_type node_type;
+
+  /**
+   * @param window_size number of samples kept, 0 for no limit
+   * @param window_age age of the oldest sample kept, zero for no limit
+   */
+  explicit AvlQuantile(size_t window_size = 0, clock::duration window_age = clock::duration::zero())
+      : window_size_(window_size), window_age_(window_age){};
+
+  void clear()
+  {
+    tree_.clear();
+    samples_.clear();
+  }
+
+  bool empty() const
+  {
+    return samples_.empty();
+  }
+
+  /**
+   * @brief number of samples in the window, repeats included
+   */
+  size_t size() const
+  {
+    return samples_.size();
+  }
+
+  const tree_type &tree() const
+  {
+    return tree_;
+  }
+
+  /**
+   * @brief add a sample stamped with the current time, evicting samples out of the window
+   *
+   * @return false if the sample is NaN, which has no rank and is ignored
+   */
+  bool push(const Key &sample)
+  {
+    return push(sample, clock::now());
+  }
+
+  /**
+   * @brief add a sample stamped with the given time, evicting samples out of the window
+   * @note The time complexity is O(log n) plus O(log n) per evicted sample
+   *
+   * @return false if the sample is NaN, which has no rank and is ignored
+   */
+  bool push(const Key &sample, clock::time_point time)
+  {
+    // NaN is neither less nor greater than any key, it would count as whatever node the descent ends on
+    if (unordered(sample, std::is_floating_point<Key>()))
+    {
+      return false;
+    }
+    node_type *node = tree_.insert(sample, 0);
+    node->data++;
+    tree_.refresh(node);
+    samples_.push_back(std::make_pair(sample, time));
+
+    if (window_size_ && samples_.size() > window_size_)
+    {
+      pop();
+    }
+    evict(time);
+    return true;
+  }
+
+  /**
+   * @brief evict the samples older than the window age
+   *
+   * @param now current time
+   */
+  void evict(clock::time_point now)
+  {
+    if (window_age_ == clock::duration::zero())
+    {
+      return;
+    }
+    while (!samples_.empty() && now - samples_.front().second > window_age_)
+    {
+      pop();
+    }
+  }
+
+  /**
+   * @brief the sample of the given quantile using the nearest rank method, the smallest sample for 0 and the largest for 1
+   * @note The time complexity is O(log n)
+   *
+   * @param q quantile in [0, 1]
+   * @return Key the sample, Key() for an empty window
+   */
+  Key quantile(double q) const
+  {
+    if (samples_.empty())
+    {
+      return Key();
+    }
+    const double rank = std::ceil(q * samples_.size());
+    return select(rank < 1 ? 0 : rank >= samples_.size() ? samples_.size() - 1 : size_t(rank) - 1);
+  }
+
+  Key median() const
+  {
+    return quantile(0.5);
+  }
+
+  /**
+   * @brief the sample at the given position of the sorted window
+   * @note The time complexity is O(log n)
+   *
+   * @param rank position from 0, less than size()
+   */
+  Key select(size_t rank) const
+  {
+    const node_type *node = tree_.root();
+    while (node)
+    {
+      const size_t left = node->left() ? node->left()->aggregate() : 0;
+      if (rank < left)
+      {
+        node = node->left();
+      }
+      else if (rank < left + node->data)
+      {
+        return node->key();
+      }
+      else
+      {
+        rank -= left + node->data;
+        node = node->right();
+      }
+    }
+    return Key();
+  }
+
+  /**
+   * @brief number of samples in the window less than the given value
+   * @note The time complexity is O(log n)
+   */
+  size_t rank(const Key &value) const
+  {
+    size_t rank = 0;
+    const node_type *node = tree_.root();
+    while (node)
+    {
+      if (node->key() < value)
+      {
+        rank += (node->left() ? node->left()->aggregate() : 0) + node->data;
+        node = node->right();
+      }
+      else
+      {
+        node = node->left();
+      }
+    }
+    return rank;
+  }
+
+private:
+  tree_type tree_;
+  // samples in arrival order
+  std::deque<std::pair<Key, clock::time_point>> samples_;
+  size_t window_size_;
+  clock::duration window_age_;
+
+  static bool unordered(const Key &sample, std::true_type)
+  {
+    return std::isnan(sample);
+  }
+
+  static bool unordered(const Key &, std::false_type)
+  {
+    return false;
+  }
+
+  /**
+   * @brief evict the oldest sample
+   */
+  void pop()
+  {
+    node_type *node = tree_.lookup(samples_.front().first);
+    if (--node->data)
+    {
+      tree_.refresh(node);
+    }
+    else
+    {
+      tree_.remove(samples_.front().first);
+    }
+    samples_.pop_front();
+  }
+};
+
+#endif // _AVL_QUANTILE__H
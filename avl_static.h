@@ -0,0 +1,226 @@
+/**
+ * @file avl_static.h
+ * @author Moshe Pontch (pontch at gmail.com)
+ * @brief Immutable search tree built at compile time, requires C++17
+ * @version 1.0
+ * @date 2022-08-31
+ *
+ */
+#ifndef _AVL_STATIC__H
+#define _AVL_STATIC__H
+
+#include <cstddef>
+
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+
+/**
+ * @brief key and data of a static tree entry
+ */
+template <class T, class Key = int>
+struct AvlStaticEntry
+{
+  Key key{};
+  T data{};
+};
+
+/**
+ * @brief immutable balanced search tree over a flat array sorted at compile time
+ *
+ * the array is the implicit perfectly balanced tree searched by bisection, so a constexpr tree lives in read only data
+ * and costs nothing at startup. A key given more than once keeps its first data, like AvlTree::insert.
+ * Key and T must be literal types, for example integers, enums or std::string_view
+ */
+template <class T, class Key, size_t N>
+class AvlStaticTree
+{
+public:
+  typedef AvlStaticEntry<T, Key> entry_type;
+
+  constexpr AvlStaticTree(const entry_type (&entries)[N]) : entries_(), count_(0)
+  {
+    // sort the positions by key then by position, so the first of equal keys comes first
+    size_t order[N] = {};
+    for (size_t i = 0; i < N; i++)
+    {
+      order[i] = i;
+    }
+    for (size_t i = N / 2; i-- > 0;)
+    {
+      sift_down(entries, order, i, N);
+    }
+    for (size_t end = N; end-- > 1;)
+    {
+      const size_t top = order[0];
+      order[0] = order[end];
+      order[end] = top;
+      sift_down(entries, order, 0, end);
+    }
+
+    for (size_t i = 0; i < N; i++)
+    {
+      const entry_type &item = entries[order[i]];
+      if (!count_ || entries_[count_ - 1].key < item.key)
+      {
+        entries_[count_++] = item;
+      }
+    }
+  }
+
+  constexpr bool empty() const
+  {
+    return count_ == 0;
+  }
+
+  /**
+   * @brief number of distinct keys
+   */
+  constexpr size_t count() const
+  {
+    return count_;
+  }
+
+  constexpr const entry_type *begin() const
+  {
+    return entries_;
+  }
+
+  constexpr const entry_type *end() const
+  {
+    return entries_ + count_;
+  }
+
+  constexpr const Key &min_key() const
+  {
+    return entries_[0].key;
+  }
+
+  constexpr const Key &max_key() const
+  {
+    return entries_[count_ - 1].key;
+  }
+
+  /**
+   * @brief the data of the given key
+   * @note The time complexity is O(log n), descending with no unpredictable branch
+   *
+   * @return const T* NULL if the key is missing
+   */
+  constexpr const T *lookup(const Key &key) const
+  {
+    const entry_type *found = lower_bound(key);
+    return found != end() && !(key < found->key) ? &found->data : NULL;
+  }
+
+  constexpr bool contains(const Key &key) const
+  {
+    return lookup(key) != NULL;
+  }
+
+  /**
+   * @brief the first entry whose key is not less than the given key, end() if there is none
+   */
+  constexpr const entry_type *lower_bound(const Key &key) const
+  {
+    if (!count_)
+    {
+      return end();
+    }
+    const entry_type *base = entries_;
+    for (size_t n = count_; n > 1; n -= n / 2)
+    {
+      base = base[n / 2].key < key ? base + n / 2 : base;
+    }
+    return base + (base->key < key);
+  }
+
+  /**
+   * @brief the first entry whose key is greater than the given key, end() if there is none
+   */
+  constexpr const entry_type *upper_bound(const Key &key) const
+  {
+    if (!count_)
+    {
+      return end();
+    }
+    const entry_type *base = entries_;
+    for (size_t n = count_; n > 1; n -= n / 2)
+    {
+      base = key < base[n / 2].key ? base : base + n / 2;
+    }
+    return base + !(key < base->key);
+  }
+
+  /**
+   * @brief number of keys in [lo, hi]
+   * @note The time complexity is O(log n)
+   */
+  constexpr size_t count(const Key &lo, const Key &hi) const
+  {
+    return hi < lo ? 0 : upper_bound(hi) - lower_bound(lo);
+  }
+
+  /**
+   * @brief visit every entry whose key is in [lo, hi] in ascending key order
+   *
+   * @param visit called as visit(const Key &, const T &)
+   */
+  template <class Visitor>
+  void for_each(const Key &lo, const Key &hi, Visitor visit) const
+  {
+    if (hi < lo)
+    {
+      return;
+    }
+    for (const entry_type *it = lower_bound(lo), *last = upper_bound(hi); it != last; ++it)
+    {
+      visit(it->key, it->data);
+    }
+  }
+
+private:
+  entry_type entries_[N];
+  size_t count_;
+
+  static constexpr bool before(const entry_type (&entries)[N], size_t a, size_t b)
+  {
+    return entries[a].key < entries[b].key || (!(entries[b].key < entries[a].key) && a < b);
+  }
+
+  static constexpr void sift_down(const entry_type (&entries)[N], size_t (&order)[N], size_t node, size_t size)
+  {
+    for (size_t child = 2 * node + 1; child < size; node = child, child = 2 * node + 1)
+    {
+      if (child + 1 < size && before(entries, order[child], order[child + 1]))
+      {
+        child++;
+      }
+      if (!before(entries, order[node], order[child]))
+      {
+        return;
+      }
+      const size_t top = order[node];
+      order[node] = order[child];
+      order[child] = top;
+    }
+  }
+};
+
+namespace avl
+{
+  /**
+   * @brief build a static tree, usually as a constexpr variable
+   *
+   * @code
+   * constexpr auto codes = avl::make_static_tree<const char *>({{404, "not found"}, {200, "ok"}});
+   * @endcode
+   */
+  template <class T, class Key = int, size_t N>
+  constexpr AvlStaticTree<T, Key, N> make_static_tree(const AvlStaticEntry<T, Key> (&entries)[N])
+  {
+    return AvlStaticTree<T, Key, N>(entries);
+  }
+} // namespace avl
+
+#endif // C++17
+
+#endif // _AVL_STATIC__H
@@ -9,10 +9,15 @@
 #ifndef _AVL_TOOL__H
 #define _AVL_TOOL__H
 
+#include <algorithm>
 #include <cmath>
 #include <iomanip>
 #include <set>
 #include <sstream>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 #include "avl.h"
 
@@ -80,6 +85,10 @@ namespace avl
         _postorder = 1L << 2,
         _inorder = 1L << 3,
         _levelorder = 1L << 4,
+        _prometheus = 1L << 5,
+        _dot = 1L << 6,
+        _json = 1L << 7,
+        _stats = 1L << 8,
     };
 
     static const avl::fmtflags summary = avl::fmtflags::_summary;
@@ -87,6 +96,10 @@ namespace avl
     static const avl::fmtflags postorder = avl::fmtflags::_postorder;
     static const avl::fmtflags inorder = avl::fmtflags::_inorder;
     static const avl::fmtflags levelorder = avl::fmtflags::_levelorder;
+    static const avl::fmtflags prometheus = avl::fmtflags::_prometheus;
+    static const avl::fmtflags dot = avl::fmtflags::_dot;
+    static const avl::fmtflags json = avl::fmtflags::_json;
+    static const avl::fmtflags stats = avl::fmtflags::_stats;
 
     template <typename Char>
     const Char _get_fmtchar(avl::_fmtchars);
@@ -118,7 +131,7 @@ namespace avl
 #define _DL avl::_get_fmtchar<Char>(avl::_fmtchars::delimiter)
 #define _UK avl::_get_fmtchar<Char>(avl::_fmtchars::unknown)
 
-static const auto _ordermask = avl::fmtflags::_preorder | avl::fmtflags::_postorder | avl::fmtflags::_inorder | avl::fmtflags::_levelorder;
+static const auto _ordermask = avl::fmtflags::_preorder | avl::fmtflags::_postorder | avl::fmtflags::_inorder | avl::fmtflags::_levelorder | avl::fmtflags::_prometheus | avl::fmtflags::_dot | avl::fmtflags::_json | avl::fmtflags::_stats;
 
 template <typename Char, typename Traits>
 inline avl::fmtflags avl_flags(std::basic_ostream<Char, Traits> &os)
@@ -179,6 +192,51 @@ inline std::basic_ostream<Char, Traits> &avl_levelorder(std::basic_ostream<Char,
     return os;
 }
 
+/**
+ * @brief print the tree telemetry using prometheus text exposition format instead of the tree content
+ * @note the tree telemetry is available only when AVL_TELEMETRY is defined
+ */
+template <typename Char, typename Traits>
+inline std::basic_ostream<Char, Traits> &avl_prometheus(std::basic_ostream<Char, Traits> &os)
+{
+    os.iword(_tree_fmt_xalloc) &= ~_ordermask;
+    os.iword(_tree_fmt_xalloc) |= avl::fmtflags::_prometheus;
+    return os;
+}
+
+/**
+ * @brief print the tree as a Graphviz DOT digraph labeled by keys
+ */
+template <typename Char, typename Traits>
+inline std::basic_ostream<Char, Traits> &avl_dot(std::basic_ostream<Char, Traits> &os)
+{
+    os.iword(_tree_fmt_xalloc) &= ~_ordermask;
+    os.iword(_tree_fmt_xalloc) |= avl::fmtflags::_dot;
+    return os;
+}
+
+/**
+ * @brief print the tree as nested JSON objects
+ */
+template <typename Char, typename Traits>
+inline std::basic_ostream<Char, Traits> &avl_json(std::basic_ostream<Char, Traits> &os)
+{
+    os.iword(_tree_fmt_xalloc) &= ~_ordermask;
+    os.iword(_tree_fmt_xalloc) |= avl::fmtflags::_json;
+    return os;
+}
+
+/**
+ * @brief print the tree structural statistics and memory footprint instead of the tree content
+ */
+template <typename Char, typename Traits>
+inline std::basic_ostream<Char, Traits> &avl_stats(std::basic_ostream<Char, Traits> &os)
+{
+    os.iword(_tree_fmt_xalloc) &= ~_ordermask;
+    os.iword(_tree_fmt_xalloc) |= avl::fmtflags::_stats;
+    return os;
+}
+
 /**
  * @brief avoid std::endl flush
  */
@@ -189,14 +247,280 @@ inline std::basic_ostream<Char, Traits> &_endl(std::basic_ostream<Char, Traits>
     return os;
 }
 
-template <class T>
+namespace avl
+{
+    /**
+     * @brief output buffer handing large blocks to the target stream buffer
+     * @note renderers format every node through a stream on top of this buffer, so writing a node costs no allocation and no virtual call into the target
+     */
+    template <typename Char, typename Traits>
+    class _render_buffer : public std::basic_streambuf<Char, Traits>
+    {
+    public:
+        typedef typename Traits::int_type int_type;
+
+        explicit _render_buffer(std::basic_streambuf<Char, Traits> *target) : target_(target), buffer_(capacity), failed_(false)
+        {
+            this->setp(&buffer_[0], &buffer_[0] + capacity);
+        }
+
+        ~_render_buffer()
+        {
+            sync();
+        }
+
+        /**
+         * @brief room to format a field in place, handing the pending block to the target first when it is short
+         *
+         * @param n number of characters, no more than the buffer capacity
+         * @return Char* where to write, pass the end of the written characters to commit
+         */
+        Char *reserve(size_t n)
+        {
+            if (size_t(this->epptr() - this->pptr()) < n && sync())
+            {
+                failed_ = true;
+            }
+            return this->pptr();
+        }
+
+        void commit(Char *end)
+        {
+            this->pbump(int(end - this->pptr()));
+        }
+
+        bool failed() const
+        {
+            return failed_;
+        }
+
+    protected:
+        int_type overflow(int_type c)
+        {
+            if (sync())
+            {
+                return Traits::eof();
+            }
+            if (!Traits::eq_int_type(c, Traits::eof()))
+            {
+                *this->pptr() = Traits::to_char_type(c);
+                this->pbump(1);
+            }
+            return Traits::not_eof(c);
+        }
+
+        int sync()
+        {
+            const std::streamsize pending = this->pptr() - this->pbase();
+            this->setp(&buffer_[0], &buffer_[0] + capacity);
+            return pending && target_->sputn(&buffer_[0], pending) != pending ? -1 : 0;
+        }
+
+    private:
+        static const size_t capacity = 1 << 16;
+
+        std::basic_streambuf<Char, Traits> *target_;
+        std::vector<Char> buffer_;
+        bool failed_;
+    };
+
+    enum _escape_style
+    {
+        _escape_json, // backslash before quotes and backslashes, DOT labels use the same rules
+        _escape_csv,  // doubled quotes, the field itself is quoted
+        _escape_tsv,  // backslash sequences for tabs, newlines and backslashes
+    };
+
+    /**
+     * @brief unbuffered filter escaping strings of DOT, JSON, CSV and TSV output
+     * @note control characters with no escape sequence are written as spaces
+     */
+    template <typename Char, typename Traits>
+    class _escape_buffer : public std::basic_streambuf<Char, Traits>
+    {
+    public:
+        typedef typename Traits::int_type int_type;
+
+        explicit _escape_buffer(std::basic_streambuf<Char, Traits> *target, _escape_style style = _escape_json) : target_(target), style_(style) {}
+
+    protected:
+        int_type overflow(int_type c)
+        {
+            if (Traits::eq_int_type(c, Traits::eof()))
+            {
+                return Traits::not_eof(c);
+            }
+            const Char ch = Traits::to_char_type(c);
+            if (style_ == _escape_csv)
+            {
+                if (ch == Char('"'))
+                {
+                    target_->sputc(ch);
+                }
+                return target_->sputc(ch);
+            }
+            if (ch == Char('\\') || (ch == Char('"') && style_ == _escape_json))
+            {
+                target_->sputc(Char('\\'));
+            }
+            else if (ch == Char('\n') || (ch == Char('\t') && style_ == _escape_tsv))
+            {
+                target_->sputc(Char('\\'));
+                return target_->sputc(Char(ch == Char('\n') ? 'n' : 't'));
+            }
+            else if (Traits::to_int_type(ch) >= 0 && Traits::to_int_type(ch) < 0x20)
+            {
+                return target_->sputc(Char(' '));
+            }
+            return target_->sputc(ch);
+        }
+
+    private:
+        std::basic_streambuf<Char, Traits> *target_;
+        _escape_style style_;
+    };
+
+    /**
+     * @brief bulk export layouts, a record per line
+     */
+    enum export_format
+    {
+        csv,    // key,data
+        tsv,    // key<TAB>data
+        ndjson, // {"key":key,"data":data}
+    };
+
+    static const char _digit_pairs[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+    /**
+     * @brief integers formatted without the stream and locale machinery, two digits per division
+     */
+    template <class V>
+    struct _fast_integer : std::integral_constant<bool, std::is_integral<V>::value && !std::is_same<V, bool>::value>
+    {
+    };
+
+    static const size_t _integer_chars = 24;
+
+    /**
+     * @brief write the decimal form of an integer, like std::to_chars
+     *
+     * @param first output, room for _integer_chars characters at least
+     * @return Char* one past the last written character
+     */
+    template <typename Char, class V>
+    Char *_to_chars(Char *first, V value)
+    {
+        typedef typename std::make_unsigned<V>::type U;
+        U magnitude = U(value);
+        if (value < V(0))
+        {
+            *first++ = Char('-');
+            magnitude = U(0) - magnitude;
+        }
+
+        char digits[_integer_chars];
+        char *const end = digits + _integer_chars;
+        char *begin = end;
+        while (magnitude >= 100)
+        {
+            const unsigned pair = unsigned(magnitude % 100) * 2;
+            magnitude /= 100;
+            *--begin = _digit_pairs[pair + 1];
+            *--begin = _digit_pairs[pair];
+        }
+        if (magnitude >= 10)
+        {
+            const unsigned pair = unsigned(magnitude) * 2;
+            *--begin = _digit_pairs[pair + 1];
+            *--begin = _digit_pairs[pair];
+        }
+        else
+        {
+            *--begin = char('0' + magnitude);
+        }
+        return std::copy(begin, end, first);
+    }
+} // namespace avl
+
+namespace avl
+{
+    /**
+     * @brief bytes held by a value, heap storage of strings and vectors included
+     * @note overload it for payload types owning more heap storage
+     */
+    template <class V>
+    size_t payload_bytes(const V &)
+    {
+        return sizeof(V);
+    }
+
+    template <typename Char, typename Traits, typename Allocator>
+    size_t payload_bytes(const std::basic_string<Char, Traits, Allocator> &value)
+    {
+        // short strings live inside the object
+        const char *data = reinterpret_cast<const char *>(value.data());
+        const bool inline_data = data >= reinterpret_cast<const char *>(&value) && data < reinterpret_cast<const char *>(&value + 1);
+        return sizeof(value) + (inline_data ? 0 : (value.capacity() + 1) * sizeof(Char));
+    }
+
+    template <class V, class Allocator>
+    size_t payload_bytes(const std::vector<V, Allocator> &value)
+    {
+        return sizeof(value) + value.capacity() * sizeof(V);
+    }
+
+    /**
+     * @brief structural statistics and memory footprint of a tree
+     */
+    struct tree_stats
+    {
+        size_t nodes;              // linked nodes, tombstones included
+        size_t tombstones;         // lazily removed nodes
+        size_t leaves;             // nodes with no child
+        int height;                // levels, 0 for an empty tree
+        int min_height;            // levels of a perfectly balanced tree holding the same nodes
+        int max_avl_height;        // the AVL height bound for the same nodes
+        size_t path_length;        // sum of all node depths, the root depth is 0
+        std::vector<size_t> depth; // number of nodes by depth
+        size_t node_bytes;         // sizeof a node
+        size_t allocated_bytes;    // a node with a typical allocator header, rounded to the allocator alignment
+        size_t key_data_bytes;     // sizeof key and data, part of node_bytes
+        size_t payload_bytes;      // keys and data, heap storage of strings and vectors included
+
+        double average_depth() const
+        {
+            return nodes ? double(path_length) / nodes : 0;
+        }
+
+        /**
+         * @brief allocated nodes plus the payload heap storage
+         */
+        size_t total_bytes() const
+        {
+            return nodes * allocated_bytes + payload_bytes - nodes * key_data_bytes;
+        }
+    };
+} // namespace avl
+
+template <class T, class Key = int, class Augment = avl::no_augment>
 class AvlNodeTool
 {
 public:
     template <typename Char, typename Traits, typename Allocator>
     static std::basic_ostream<Char, Traits> &preorder(
         std::basic_ostream<Char, Traits> &os,
-        const AvlNode<T> *node,
+        const AvlNode<T, Key, Augment> *node,
         const std::basic_string<Char, Traits, Allocator> prefix,
         bool is_left = false,
         bool root = true)
@@ -208,11 +532,11 @@ public:
             const std::basic_string<Char, Traits, Allocator> next_prefix = root ? std::basic_string<Char, Traits, Allocator>() : prefix + (is_left ? _VL : _SP) + _SP + _SP;
             if (node->left())
             {
-                AvlNodeTool<T>::preorder(os, node->left(), next_prefix, node->right(), false);
+                AvlNodeTool<T, Key, Augment>::preorder(os, node->left(), next_prefix, node->right(), false);
             }
             if (node->right())
             {
-                AvlNodeTool<T>::preorder(os, node->right(), next_prefix, false, false);
+                AvlNodeTool<T, Key, Augment>::preorder(os, node->right(), next_prefix, false, false);
             }
         }
         return os;
@@ -221,7 +545,7 @@ public:
     template <typename Char, typename Traits, typename Allocator>
     static std::basic_ostream<Char, Traits> &inorder(
         std::basic_ostream<Char, Traits> &os,
-        const AvlNode<T> *node,
+        const AvlNode<T, Key, Augment> *node,
         const std::basic_string<Char, Traits, Allocator> prefix,
         bool is_left = false,
         bool root = true)
@@ -231,14 +555,14 @@ public:
             if (node->left())
             {
                 const std::basic_string<Char, Traits, Allocator> left_prefix = root ? std::basic_string<Char, Traits, Allocator>() : prefix + (is_left ? _SP : _VL) + _SP + _SP;
-                AvlNodeTool<T>::inorder(os, node->left(), left_prefix, true, false);
+                AvlNodeTool<T, Key, Augment>::inorder(os, node->left(), left_prefix, true, false);
             }
             const std::basic_string<Char, Traits, Allocator> this_prefix = root ? std::basic_string<Char, Traits, Allocator>() : prefix + (is_left ? _TL : _BL) + _HL + _HL;
             os << this_prefix << node << _endl;
             if (node->right())
             {
                 const std::basic_string<Char, Traits, Allocator> right_prefix = root ? std::basic_string<Char, Traits, Allocator>() : prefix + (is_left ? _VL : _SP) + _SP + _SP;
-                AvlNodeTool<T>::inorder(os, node->right(), right_prefix, false, false);
+                AvlNodeTool<T, Key, Augment>::inorder(os, node->right(), right_prefix, false, false);
             }
         }
         return os;
@@ -247,7 +571,7 @@ public:
     template <typename Char, typename Traits, typename Allocator>
     static std::basic_ostream<Char, Traits> &postorder(
         std::basic_ostream<Char, Traits> &os,
-        const AvlNode<T> *node,
+        const AvlNode<T, Key, Augment> *node,
         const std::basic_string<Char, Traits, Allocator> prefix,
         bool is_left = false,
         bool root = true)
@@ -257,11 +581,11 @@ public:
             const std::basic_string<Char, Traits, Allocator> next_prefix = root ? std::basic_string<Char, Traits, Allocator>() : prefix + (is_left ? _VL : _SP) + _SP + _SP;
             if (node->right())
             {
-                AvlNodeTool<T>::postorder(os, node->right(), next_prefix, false, false);
+                AvlNodeTool<T, Key, Augment>::postorder(os, node->right(), next_prefix, false, false);
             }
             if (node->left())
             {
-                AvlNodeTool<T>::postorder(os, node->left(), next_prefix, node->right(), false);
+                AvlNodeTool<T, Key, Augment>::postorder(os, node->left(), next_prefix, node->right(), false);
             }
             const std::basic_string<Char, Traits, Allocator> this_prefix = root ? std::basic_string<Char, Traits, Allocator>() : prefix + (is_left ? _VR : _TL) + _HL + _HL;
             os << this_prefix << *node << _endl;
@@ -272,7 +596,7 @@ public:
     template <typename Char, typename Traits>
     static std::basic_ostream<Char, Traits> &levelorder(
         std::basic_ostream<Char, Traits> &os,
-        AvlNode<T> *node,
+        AvlNode<T, Key, Augment> *node,
         int node_width,
         int width,
         int level,
@@ -340,7 +664,7 @@ public:
     template <typename Char, typename Traits>
     static std::basic_ostream<Char, Traits> &levelorder(
         std::basic_ostream<Char, Traits> &os,
-        AvlNode<T> *node,
+        AvlNode<T, Key, Augment> *node,
         int node_width)
     {
         if (node)
@@ -355,9 +679,256 @@ public:
         return os;
     }
 
+
+    /**
+     * @brief print the subtree with the preorder layout, in O(n) time and O(h) memory
+     * @note a single prefix buffer is trimmed and extended while walking the parent links, and the output goes through a large buffer,
+     *  so rendering allocates nothing per node. A cut subtree is shown as "..."
+     *
+     * @param os output stream
+     * @param root subtree root
+     * @param max_depth number of levels to print, 0 prints all of them
+     * @param max_nodes number of nodes to print, 0 prints all of them
+     */
+    template <typename Char, typename Traits>
+    static std::basic_ostream<Char, Traits> &render(
+        std::basic_ostream<Char, Traits> &os,
+        const AvlNode<T, Key, Augment> *root,
+        int max_depth = 0,
+        size_t max_nodes = 0)
+    {
+        if (!root)
+        {
+            return os;
+        }
+
+        avl::_render_buffer<Char, Traits> buffer(os.rdbuf());
+        std::basic_ostream<Char, Traits> out(&buffer);
+        out.copyfmt(os);
+
+        std::basic_string<Char, Traits> prefix;
+        size_t rendered = 0;
+        int depth = 0;
+        for (const AvlNode<T, Key, Augment> *node = root; node;)
+        {
+            if (max_nodes && rendered == max_nodes)
+            {
+                out << "..." << _endl;
+                break;
+            }
+            rendered++;
+
+            if (depth)
+            {
+                const AvlNode<T, Key, Augment> *parent = node->parent();
+                const bool is_left = parent->left() == node && parent->right();
+                prefix.resize(3 * (depth - 1));
+                out.write(prefix.data(), prefix.size());
+                out << (is_left ? _VR : _BL) << _HL << _HL << *node << _endl;
+                prefix.push_back(is_left ? _VL : _SP);
+                prefix.append(2, _SP);
+            }
+            else
+            {
+                out << *node << _endl;
+            }
+
+            if (node->left() || node->right())
+            {
+                if (!max_depth || depth + 1 < max_depth)
+                {
+                    node = node->left() ? node->left() : node->right();
+                    depth++;
+                    continue;
+                }
+                out.write(prefix.data(), prefix.size());
+                out << _BL << _HL << _HL << "..." << _endl;
+            }
+            node = next_preorder(root, node, depth);
+        }
+
+        if (!out)
+        {
+            os.setstate(std::ios_base::badbit);
+        }
+        return os;
+    }
+
+    /**
+     * @brief print the subtree as a Graphviz DOT digraph labeled by keys, in O(n) time and O(h) memory
+     *
+     * @param os output stream
+     * @param root subtree root
+     * @param name graph name
+     */
+    template <typename Char, typename Traits>
+    static std::basic_ostream<Char, Traits> &dot(
+        std::basic_ostream<Char, Traits> &os,
+        const AvlNode<T, Key, Augment> *root,
+        const char *name = "avl")
+    {
+        avl::_render_buffer<Char, Traits> buffer(os.rdbuf());
+        std::basic_ostream<Char, Traits> out(&buffer);
+        out.copyfmt(os);
+        avl::_escape_buffer<Char, Traits> escape(&buffer);
+        std::basic_ostream<Char, Traits> escaped(&escape);
+        escaped.copyfmt(os);
+
+        out << "digraph " << name << " {" << _endl;
+        // preorder ids of the current path
+        std::vector<size_t> path;
+        size_t id = 0;
+        int depth = 0;
+        for (const AvlNode<T, Key, Augment> *node = root; node; id++)
+        {
+            path.resize(depth);
+            out << "  n" << id << " [label=\"";
+            escaped << node->key();
+            out << "\"];" << _endl;
+            if (depth)
+            {
+                out << "  n" << path.back() << " -> n" << id << ";" << _endl;
+            }
+            path.push_back(id);
+
+            if (node->left() || node->right())
+            {
+                node = node->left() ? node->left() : node->right();
+                depth++;
+                continue;
+            }
+            node = next_preorder(root, node, depth);
+        }
+        out << "}" << _endl;
+
+        if (!out)
+        {
+            os.setstate(std::ios_base::badbit);
+        }
+        return os;
+    }
+
+    /**
+     * @brief print the subtree as nested JSON objects, in O(n) time and O(1) extra memory
+     * @note arithmetic keys and data are written as numbers, anything else as an escaped string
+     *
+     * @param os output stream
+     * @param root subtree root
+     */
+    template <typename Char, typename Traits>
+    static std::basic_ostream<Char, Traits> &json(
+        std::basic_ostream<Char, Traits> &os,
+        const AvlNode<T, Key, Augment> *root)
+    {
+        avl::_render_buffer<Char, Traits> buffer(os.rdbuf());
+        std::basic_ostream<Char, Traits> out(&buffer);
+        out.copyfmt(os);
+        avl::_escape_buffer<Char, Traits> escape(&buffer);
+        std::basic_ostream<Char, Traits> escaped(&escape);
+        escaped.copyfmt(os);
+
+        const AvlNode<T, Key, Augment> *node = root;
+        while (node)
+        {
+            out << "{\"key\":";
+            _json(out, escaped, node->key());
+            out << ",\"data\":";
+            _json(out, escaped, node->data);
+            out << ",\"height\":" << node->height() << ",\"left\":";
+            if (node->left())
+            {
+                node = node->left();
+                continue;
+            }
+            out << "null,\"right\":";
+            if (node->right())
+            {
+                node = node->right();
+                continue;
+            }
+            out << "null}";
+
+            // close the finished subtrees, then open the first pending right subtree
+            for (;;)
+            {
+                if (node == root)
+                {
+                    node = NULL;
+                    break;
+                }
+                const AvlNode<T, Key, Augment> *parent = node->parent();
+                if (parent->left() == node)
+                {
+                    out << ",\"right\":";
+                    if (parent->right())
+                    {
+                        node = parent->right();
+                        break;
+                    }
+                    out << "null";
+                }
+                out << "}";
+                node = parent;
+            }
+        }
+        if (!root)
+        {
+            out << "null";
+        }
+        out << _endl;
+
+        if (!out)
+        {
+            os.setstate(std::ios_base::badbit);
+        }
+        return os;
+    }
+
 private:
     AvlNodeTool(){};
 
+    /**
+     * @brief the preorder successor of a node without children, climbing to the nearest pending right subtree
+     *
+     * @param root subtree root, the walk never leaves it
+     * @param node node whose subtree was visited
+     * @param depth node depth, updated to the depth of the returned node
+     * @return NULL once the subtree is over
+     */
+    static const AvlNode<T, Key, Augment> *next_preorder(const AvlNode<T, Key, Augment> *root, const AvlNode<T, Key, Augment> *node, int &depth)
+    {
+        for (; node != root; depth--)
+        {
+            const AvlNode<T, Key, Augment> *parent = node->parent();
+            if (parent->left() == node && parent->right())
+            {
+                return parent->right();
+            }
+            node = parent;
+        }
+        return NULL;
+    }
+
+    template <typename Char, typename Traits, typename V>
+    static void _json(std::basic_ostream<Char, Traits> &out, std::basic_ostream<Char, Traits> &escaped, const V &value)
+    {
+        _json(out, escaped, value, std::is_arithmetic<V>());
+    }
+
+    template <typename Char, typename Traits, typename V>
+    static void _json(std::basic_ostream<Char, Traits> &out, std::basic_ostream<Char, Traits> &, const V &value, std::true_type)
+    {
+        out << +value;
+    }
+
+    template <typename Char, typename Traits, typename V>
+    static void _json(std::basic_ostream<Char, Traits> &out, std::basic_ostream<Char, Traits> &escaped, const V &value, std::false_type)
+    {
+        out << '"';
+        escaped << value;
+        out << '"';
+    }
+
     static inline const std::string _s(size_t n, const char c)
     {
         return std::string(n, c);
@@ -369,55 +940,80 @@ private:
     }
 };
 
-template <class T>
+template <class T, class Key = int, class Augment = avl::no_augment, class Balance = avl::avl_balance>
 class AvlTreeTool
 {
 public:
-    static bool is_tree(const AvlTree<T> &tree)
+    static bool is_tree(const AvlTree<T, Key, Augment, Balance> &tree)
     {
-        std::set<const AvlNode<T> *> visited;
+        std::set<const AvlNode<T, Key, Augment> *> visited;
         return is_tree(visited, tree.root());
     }
 
     template <typename Char, typename Traits>
-    static std::basic_ostream<Char, Traits> &preorder(std::basic_ostream<Char, Traits> &os, const AvlTree<T> &tree)
+    static std::basic_ostream<Char, Traits> &preorder(std::basic_ostream<Char, Traits> &os, const AvlTree<T, Key, Augment, Balance> &tree)
     {
-        AvlNodeTool<T>::preorder(os, tree.root(), std::basic_string<Char, Traits, std::allocator<Char>>());
-        return os;
+        return AvlNodeTool<T, Key, Augment>::render(os, tree.root());
+    }
+
+    /**
+     * @brief print the tree with the preorder layout, truncated for large trees
+     *
+     * @param os output stream
+     * @param tree tree to print
+     * @param max_depth number of levels to print, 0 prints all of them
+     * @param max_nodes number of nodes to print, 0 prints all of them
+     */
+    template <typename Char, typename Traits>
+    static std::basic_ostream<Char, Traits> &render(std::basic_ostream<Char, Traits> &os, const AvlTree<T, Key, Augment, Balance> &tree, int max_depth = 0, size_t max_nodes = 0)
+    {
+        return AvlNodeTool<T, Key, Augment>::render(os, tree.root(), max_depth, max_nodes);
+    }
+
+    template <typename Char, typename Traits>
+    static std::basic_ostream<Char, Traits> &dot(std::basic_ostream<Char, Traits> &os, const AvlTree<T, Key, Augment, Balance> &tree, const char *name = "avl")
+    {
+        return AvlNodeTool<T, Key, Augment>::dot(os, tree.root(), name);
+    }
+
+    template <typename Char, typename Traits>
+    static std::basic_ostream<Char, Traits> &json(std::basic_ostream<Char, Traits> &os, const AvlTree<T, Key, Augment, Balance> &tree)
+    {
+        return AvlNodeTool<T, Key, Augment>::json(os, tree.root());
     }
 
     template <typename Char, typename Traits>
-    static std::basic_ostream<Char, Traits> &inorder(std::basic_ostream<Char, Traits> &os, const AvlTree<T> &tree)
+    static std::basic_ostream<Char, Traits> &inorder(std::basic_ostream<Char, Traits> &os, const AvlTree<T, Key, Augment, Balance> &tree)
     {
-        AvlNodeTool<T>::inorder(os, tree.root(), std::basic_string<Char, Traits, std::allocator<Char>>());
+        AvlNodeTool<T, Key, Augment>::inorder(os, tree.root(), std::basic_string<Char, Traits, std::allocator<Char>>());
         return os;
     }
 
     template <typename Char, typename Traits>
-    static std::basic_ostream<Char, Traits> &postorder(std::basic_ostream<Char, Traits> &os, const AvlTree<T> &tree)
+    static std::basic_ostream<Char, Traits> &postorder(std::basic_ostream<Char, Traits> &os, const AvlTree<T, Key, Augment, Balance> &tree)
     {
-        AvlNodeTool<T>::postorder(os, tree.root(), std::basic_string<Char, Traits, std::allocator<Char>>());
+        AvlNodeTool<T, Key, Augment>::postorder(os, tree.root(), std::basic_string<Char, Traits, std::allocator<Char>>());
         return os;
     }
 
     template <typename Char, typename Traits>
-    static std::basic_ostream<Char, Traits> &levelorder(std::basic_ostream<Char, Traits> &os, const AvlTree<T> &tree)
+    static std::basic_ostream<Char, Traits> &levelorder(std::basic_ostream<Char, Traits> &os, const AvlTree<T, Key, Augment, Balance> &tree)
     {
-        AvlNodeTool<T>::levelorder(os, tree.root(), log10(tree.max_key()) + 1);
+        AvlNodeTool<T, Key, Augment>::levelorder(os, tree.root(), node_width<Char, Traits>(tree));
         return os;
     }
 
     template <typename Char, typename Traits>
-    static std::basic_ostream<Char, Traits> &summary(std::basic_ostream<Char, Traits> &os, const AvlTree<T> &tree)
+    static std::basic_ostream<Char, Traits> &summary(std::basic_ostream<Char, Traits> &os, const AvlTree<T, Key, Augment, Balance> &tree)
     {
         os << "#:" << tree.count() << ",L:" << tree.min_left() << ",R:" << tree.max_right();
         return os;
     }
 
     template <typename Char, typename Traits>
-    static std::basic_ostream<Char, Traits> &flatten(std::basic_ostream<Char, Traits> &os, const AvlTree<T> &tree, const Char delimiter = _DL)
+    static std::basic_ostream<Char, Traits> &flatten(std::basic_ostream<Char, Traits> &os, const AvlTree<T, Key, Augment, Balance> &tree, const Char delimiter = _DL)
     {
-        AvlNode<T> *node = tree.min_left();
+        AvlNode<T, Key, Augment> *node = tree.min_left();
         bool first = true;
         os << _LB;
         while (node)
@@ -434,19 +1030,282 @@ public:
         return os;
     }
 
+    /**
+     * @brief gather structural statistics and memory footprint in a single pass
+     * @note The time complexity is O(n), the walk keeps an explicit O(h) path so it does not recurse
+     */
+    static avl::tree_stats stats(const AvlTree<T, Key, Augment, Balance> &tree)
+    {
+        avl::tree_stats stats = avl::tree_stats();
+        stats.tombstones = tree.tombstones();
+        stats.height = tree.height();
+        stats.depth.resize(stats.height);
+        stats.node_bytes = sizeof(AvlNode<T, Key, Augment>);
+        // typical malloc chunk, a size header rounded to twice the pointer size
+        const size_t align = 2 * sizeof(void *);
+        stats.allocated_bytes = std::max(2 * align, (stats.node_bytes + sizeof(void *) + align - 1) / align * align);
+        stats.key_data_bytes = sizeof(Key) + sizeof(T);
+
+        std::vector<std::pair<const AvlNode<T, Key, Augment> *, int>> path;
+        path.reserve(stats.height);
+        if (tree.root())
+        {
+            path.push_back(std::make_pair(tree.root(), 0));
+        }
+        while (!path.empty())
+        {
+            const AvlNode<T, Key, Augment> *node = path.back().first;
+            const int depth = path.back().second;
+            path.pop_back();
+
+            stats.nodes++;
+            stats.path_length += depth;
+            stats.depth[depth]++;
+            stats.payload_bytes += avl::payload_bytes(node->key()) + avl::payload_bytes(node->data);
+            if (!node->left() && !node->right())
+            {
+                stats.leaves++;
+            }
+            if (node->right())
+            {
+                path.push_back(std::make_pair(node->right(), depth + 1));
+            }
+            if (node->left())
+            {
+                path.push_back(std::make_pair(node->left(), depth + 1));
+            }
+        }
+
+        for (size_t capacity = 0; capacity < stats.nodes; capacity = 2 * capacity + 1)
+        {
+            stats.min_height++;
+        }
+        // the sparsest AVL tree of height h holds N(h) = N(h - 1) + N(h - 2) + 1 nodes
+        for (size_t sparse = 1, sparser = 0; sparse <= stats.nodes; stats.max_avl_height++)
+        {
+            const size_t next = sparse + sparser + 1;
+            sparser = sparse;
+            sparse = next;
+        }
+        return stats;
+    }
+
+    template <typename Char, typename Traits>
+    static std::basic_ostream<Char, Traits> &stats(std::basic_ostream<Char, Traits> &os, const AvlTree<T, Key, Augment, Balance> &tree)
+    {
+        const avl::tree_stats stats = AvlTreeTool<T, Key, Augment, Balance>::stats(tree);
+        os << "nodes: " << stats.nodes << _endl;
+        os << "tombstones: " << stats.tombstones << _endl;
+        os << "leaves: " << stats.leaves << _endl;
+        os << "height: " << stats.height << " (min " << stats.min_height << ", AVL bound " << stats.max_avl_height << ")" << _endl;
+        os << "depth: average " << stats.average_depth() << ", max " << std::max(0, stats.height - 1) << _endl;
+        os << "depth histogram:";
+        for (size_t depth = 0; depth < stats.depth.size(); depth++)
+        {
+            os << " " << stats.depth[depth];
+        }
+        os << _endl;
+        os << "node bytes: " << stats.node_bytes << " (" << stats.allocated_bytes << " allocated)" << _endl;
+        os << "payload bytes: " << stats.payload_bytes << _endl;
+        os << "total bytes: " << stats.total_bytes() << _endl;
+        return os;
+    }
+
+    /**
+     * @brief write every key and data in ascending key order, a record per line
+     * @note integral keys and data are formatted in place into a large buffer handed to the stream in whole blocks,
+     *  other types go through the stream formatting with the stream settings and are escaped for the layout.
+     *  The walk keeps an explicit O(h) path rather than climbing parents for every key
+     *
+     * @param os output stream
+     * @param tree tree to export
+     * @param format record layout
+     * @param header start CSV and TSV output with a key and data header line
+     */
+    template <typename Char, typename Traits>
+    static std::basic_ostream<Char, Traits> &bulk_export(std::basic_ostream<Char, Traits> &os, const AvlTree<T, Key, Augment, Balance> &tree, avl::export_format format = avl::csv, bool header = false)
+    {
+        avl::_render_buffer<Char, Traits> buffer(os.rdbuf());
+        std::basic_ostream<Char, Traits> out(&buffer);
+        out.copyfmt(os);
+        avl::_escape_buffer<Char, Traits> escape(&buffer, format == avl::csv ? avl::_escape_csv : format == avl::tsv ? avl::_escape_tsv : avl::_escape_json);
+        std::basic_ostream<Char, Traits> escaped(&escape);
+        escaped.copyfmt(os);
+
+        const Char separator = format == avl::tsv ? Char('\t') : Char(',');
+        if (header && format != avl::ndjson)
+        {
+            out << "key" << separator << "data" << _endl;
+        }
+
+        std::vector<const AvlNode<T, Key, Augment> *> path;
+        path.reserve(tree.height());
+        for (const AvlNode<T, Key, Augment> *node = tree.root(); node || !path.empty();)
+        {
+            if (node)
+            {
+                path.push_back(node);
+                node = node->left();
+                continue;
+            }
+            node = path.back();
+            path.pop_back();
+
+            if (!node->tombstone())
+            {
+                if (format == avl::ndjson)
+                {
+                    out << "{\"key\":";
+                    _field(buffer, out, escaped, format, node->key());
+                    out << ",\"data\":";
+                    _field(buffer, out, escaped, format, node->data);
+                    buffer.sputc(Char('}'));
+                }
+                else
+                {
+                    _field(buffer, out, escaped, format, node->key());
+                    buffer.sputc(separator);
+                    _field(buffer, out, escaped, format, node->data);
+                }
+                buffer.sputc(Char('\n'));
+            }
+            node = node->right();
+        }
+
+        if (!out || buffer.failed())
+        {
+            os.setstate(std::ios_base::badbit);
+        }
+        return os;
+    }
+
+    /**
+     * @brief print the tree telemetry using prometheus text exposition format
+     *
+     * @param os output stream
+     * @param tree tree to report
+     * @param name metric name prefix
+     */
+    template <typename Char, typename Traits>
+    static std::basic_ostream<Char, Traits> &prometheus(std::basic_ostream<Char, Traits> &os, const AvlTree<T, Key, Augment, Balance> &tree, const char *name = "avl")
+    {
+#ifdef AVL_TELEMETRY
+        const AvlTelemetry &telemetry = tree.telemetry();
+
+        _metric(os, name, "_nodes", "gauge", "Number of nodes in the tree.");
+        os << name << "_nodes " << tree.count() << _endl;
+        _metric(os, name, "_height", "gauge", "Height of the tree.");
+        os << name << "_height " << tree.height() << _endl;
+
+        _metric(os, name, "_comparisons_total", "counter", "Key comparisons, by operation.");
+        for (int op = 0; op < AvlTelemetry::_OP_COUNT; op++)
+        {
+            os << name << "_comparisons_total{op=\"" << AvlTelemetry::op_name(op) << "\"} " << telemetry.comparisons[op] << _endl;
+        }
+        _metric(os, name, "_rotations_total", "counter", "Single rotations, by operation and direction.");
+        for (int op = 0; op < AvlTelemetry::_OP_COUNT; op++)
+        {
+            os << name << "_rotations_total{op=\"" << AvlTelemetry::op_name(op) << "\",dir=\"left\"} " << telemetry.rotations_left[op] << _endl;
+            os << name << "_rotations_total{op=\"" << AvlTelemetry::op_name(op) << "\",dir=\"right\"} " << telemetry.rotations_right[op] << _endl;
+        }
+        _metric(os, name, "_allocations_total", "counter", "Allocated nodes.");
+        os << name << "_allocations_total " << telemetry.allocations << _endl;
+        _metric(os, name, "_frees_total", "counter", "Freed nodes.");
+        os << name << "_frees_total " << telemetry.frees << _endl;
+        _metric(os, name, "_retrace_levels_total", "counter", "Levels retraced on the way back to the root.");
+        os << name << "_retrace_levels_total " << telemetry.retrace_levels << _endl;
+        _metric(os, name, "_retrace_depth_max", "gauge", "Deepest retracing of a single operation.");
+        os << name << "_retrace_depth_max " << telemetry.max_retrace_depth << _endl;
+
+        _metric(os, name, "_latency_ns", "histogram", "Operation latency in nanoseconds.");
+        for (int op = 0; op < AvlTelemetry::_OP_COUNT; op++)
+        {
+            AvlTelemetry::counter cumulative = 0;
+            for (int bucket = 0; bucket < AvlTelemetry::latency_buckets - 1; bucket++)
+            {
+                cumulative += telemetry.latency[op][bucket];
+                os << name << "_latency_ns_bucket{op=\"" << AvlTelemetry::op_name(op) << "\",le=\"" << (AvlTelemetry::counter(1) << bucket) << "\"} " << cumulative << _endl;
+            }
+            os << name << "_latency_ns_bucket{op=\"" << AvlTelemetry::op_name(op) << "\",le=\"+Inf\"} " << telemetry.operations[op] << _endl;
+            os << name << "_latency_ns_sum{op=\"" << AvlTelemetry::op_name(op) << "\"} " << telemetry.latency_ns_sum[op] << _endl;
+            os << name << "_latency_ns_count{op=\"" << AvlTelemetry::op_name(op) << "\"} " << telemetry.operations[op] << _endl;
+        }
+#else
+        (void)tree;
+        os << "# " << name << " telemetry is disabled, define AVL_TELEMETRY to enable it" << _endl;
+#endif
+        return os;
+    }
+
 private:
     AvlTreeTool(){};
+
+    /**
+     * @brief the length of the widest formatted node, so the level order columns fit any streamable content
+     * @note The time complexity is O(n)
+     */
+    template <typename Char, typename Traits>
+    static int node_width(const AvlTree<T, Key, Augment, Balance> &tree)
+    {
+        size_t width = 1;
+        for (AvlNode<T, Key, Augment> *node = tree.min_left(); node; node = node->next())
+        {
+            std::basic_stringstream<Char, Traits, std::allocator<Char>> ss;
+            ss << *node;
+            width = std::max(width, ss.str().length());
+        }
+        return int(width);
+    }
+
+    template <typename Char, typename Traits, class V>
+    static void _field(avl::_render_buffer<Char, Traits> &buffer, std::basic_ostream<Char, Traits> &out, std::basic_ostream<Char, Traits> &escaped, avl::export_format format, const V &value)
+    {
+        _field(buffer, out, escaped, format, value, avl::_fast_integer<V>(), std::is_arithmetic<V>());
+    }
+
+    template <typename Char, typename Traits, class V, class Arithmetic>
+    static void _field(avl::_render_buffer<Char, Traits> &buffer, std::basic_ostream<Char, Traits> &, std::basic_ostream<Char, Traits> &, avl::export_format, const V &value, std::true_type, Arithmetic)
+    {
+        buffer.commit(avl::_to_chars(buffer.reserve(avl::_integer_chars), value));
+    }
+
+    template <typename Char, typename Traits, class V>
+    static void _field(avl::_render_buffer<Char, Traits> &, std::basic_ostream<Char, Traits> &out, std::basic_ostream<Char, Traits> &, avl::export_format, const V &value, std::false_type, std::true_type)
+    {
+        out << +value;
+    }
+
+    template <typename Char, typename Traits, class V>
+    static void _field(avl::_render_buffer<Char, Traits> &buffer, std::basic_ostream<Char, Traits> &, std::basic_ostream<Char, Traits> &escaped, avl::export_format format, const V &value, std::false_type, std::false_type)
+    {
+        if (format != avl::tsv)
+        {
+            buffer.sputc(Char('"'));
+        }
+        escaped << value;
+        if (format != avl::tsv)
+        {
+            buffer.sputc(Char('"'));
+        }
+    }
+
+    template <typename Char, typename Traits>
+    static void _metric(std::basic_ostream<Char, Traits> &os, const char *name, const char *suffix, const char *type, const char *help)
+    {
+        os << "# HELP " << name << suffix << " " << help << _endl;
+        os << "# TYPE " << name << suffix << " " << type << _endl;
+    }
 };
 
-template <class T, typename Char, typename Traits>
-std::basic_ostream<Char, Traits> &operator<<(std::basic_ostream<Char, Traits> &os, const AvlNode<T> &node)
+template <class T, class Key, class Augment, typename Char, typename Traits>
+std::basic_ostream<Char, Traits> &operator<<(std::basic_ostream<Char, Traits> &os, const AvlNode<T, Key, Augment> &node)
 {
     os << node.data;
     return os;
 }
 
-template <class T, typename Char, typename Traits>
-std::basic_ostream<Char, Traits> &operator<<(std::basic_ostream<Char, Traits> &os, const AvlNode<T> *node)
+template <class T, class Key, class Augment, typename Char, typename Traits>
+std::basic_ostream<Char, Traits> &operator<<(std::basic_ostream<Char, Traits> &os, const AvlNode<T, Key, Augment> *node)
 {
     if (node)
     {
@@ -463,32 +1322,44 @@ std::basic_ostream<Char, Traits> &operator<<(std::basic_ostream<Char, Traits> &o
     return os;
 }
 
-template <class T, typename Char, typename Traits>
-std::basic_ostream<Char, Traits> &operator<<(std::basic_ostream<Char, Traits> &os, const AvlTree<T> &tree)
+template <class T, class Key, class Augment, class Balance, typename Char, typename Traits>
+std::basic_ostream<Char, Traits> &operator<<(std::basic_ostream<Char, Traits> &os, const AvlTree<T, Key, Augment, Balance> &tree)
 {
     const auto flags = avl_flags(os);
 
     if (flags & avl::fmtflags::_summary)
     {
-        AvlTreeTool<T>::summary(os, tree) << _endl;
+        AvlTreeTool<T, Key, Augment, Balance>::summary(os, tree) << _endl;
     }
 
     switch (flags & _ordermask)
     {
     case avl::fmtflags::_preorder:
-        AvlTreeTool<T>::preorder(os, tree);
+        AvlTreeTool<T, Key, Augment, Balance>::preorder(os, tree);
         break;
     case avl::fmtflags::_postorder:
-        AvlTreeTool<T>::postorder(os, tree);
+        AvlTreeTool<T, Key, Augment, Balance>::postorder(os, tree);
         break;
     case avl::fmtflags::_inorder:
-        AvlTreeTool<T>::inorder(os, tree);
+        AvlTreeTool<T, Key, Augment, Balance>::inorder(os, tree);
         break;
     case avl::fmtflags::_levelorder:
-        AvlTreeTool<T>::levelorder(os, tree);
+        AvlTreeTool<T, Key, Augment, Balance>::levelorder(os, tree);
+        break;
+    case avl::fmtflags::_prometheus:
+        AvlTreeTool<T, Key, Augment, Balance>::prometheus(os, tree);
+        break;
+    case avl::fmtflags::_dot:
+        AvlTreeTool<T, Key, Augment, Balance>::dot(os, tree);
+        break;
+    case avl::fmtflags::_json:
+        AvlTreeTool<T, Key, Augment, Balance>::json(os, tree);
+        break;
+    case avl::fmtflags::_stats:
+        AvlTreeTool<T, Key, Augment, Balance>::stats(os, tree);
         break;
     default:
-        AvlTreeTool<T>::flatten(os, tree);
+        AvlTreeTool<T, Key, Augment, Balance>::flatten(os, tree);
         break;
     }
 
@@ -0,0 +1,698 @@
+/**
+ * @file bench.cpp
+ * @author Moshe Pontch (pontch at gmail.com)
+ * @brief Microbenchmarks of the AVL library compared with std::map and std::set
+ * @date 2022-08-31
+ *
+ * Every line of output is a CSV record (or a JSON object with --json), one per
+ * container, workload, operation and tree size, so runs can be diffed and tracked.
+ *
+ * usage: bench [--min N] [--max N] [--json]
+ *              [--containers avl,avl_lean,map,set]
+ *              [--workloads sequential,uniform,zipf,mixed]
+ *              [--ops insert,lookup,remove,iterate,clone]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "avl.h"
+#include "avl_lean.h"
+
+using namespace std;
+using namespace std::chrono;
+
+/* minimal amount of operations per measurement, small trees are measured in rounds */
+constexpr auto _MIN_OPS = 1000000;
+/* maximal amount of individually timed operations per measurement */
+constexpr auto _MAX_SAMPLES = 1000000;
+/* zipfian skew, as used by YCSB */
+constexpr auto _ZIPF_THETA = 0.99;
+/* mixed workload read percentage, the rest is split evenly between inserts and removes */
+constexpr auto _MIXED_READS = 80;
+
+/* avoid the optimizer dropping the measured work */
+static volatile uint64_t _sink;
+
+typedef steady_clock bench_clock;
+
+/**
+ * @brief zipfian generator over [0, n) (Gray et al., "Quickly Generating Billion-Record Synthetic Databases")
+ */
+class Zipf
+{
+public:
+    Zipf(uint64_t n, double theta, uint64_t seed) : n_(n), theta_(theta), rng_(seed)
+    {
+        double zeta2 = 0;
+        zetan_ = 0;
+        for (uint64_t i = 1; i <= n; i++)
+        {
+            zetan_ += 1.0 / pow(double(i), theta);
+            if (i == 2)
+            {
+                zeta2 = zetan_;
+            }
+        }
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1.0 - pow(2.0 / double(n), 1.0 - theta)) / (1.0 - zeta2 / zetan_);
+    }
+
+    uint64_t operator()()
+    {
+        const double u = uniform_real_distribution<double>(0.0, 1.0)(rng_);
+        const double uz = u * zetan_;
+        if (uz < 1.0)
+        {
+            return 0;
+        }
+        if (uz < 1.0 + pow(0.5, theta_))
+        {
+            return 1;
+        }
+        return min<uint64_t>(n_ - 1, uint64_t(double(n_) * pow(eta_ * u - eta_ + 1.0, alpha_)));
+    }
+
+private:
+    uint64_t n_;
+    double theta_;
+    double zetan_;
+    double alpha_;
+    double eta_;
+    mt19937_64 rng_;
+};
+
+struct AvlAdapter
+{
+    typedef AvlTree<int> container;
+    static const char *name() { return "avl"; }
+    static void insert(container &c, int key) { c.insert(key, key); }
+    static bool lookup(const container &c, int key) { return c.lookup(key) != NULL; }
+    static void remove(container &c, int key) { c.remove(key); }
+    static uint64_t iterate(const container &c)
+    {
+        uint64_t sum = 0;
+        for (const AvlNode<int> *node = c.min_left(); node; node = node->next())
+        {
+            sum += node->data;
+        }
+        return sum;
+    }
+    static uint64_t clone(const container &c)
+    {
+        container copy(c);
+        return copy.count();
+    }
+};
+
+struct AvlLeanAdapter
+{
+    typedef AvlLeanTree<int> container;
+    static const char *name() { return "avl_lean"; }
+    static void insert(container &c, int key) { c.insert(key, key); }
+    static bool lookup(const container &c, int key) { return c.lookup(key) != NULL; }
+    static void remove(container &c, int key) { c.remove(key); }
+    static uint64_t iterate(const container &c)
+    {
+        uint64_t sum = 0;
+        for (const auto &node : c)
+        {
+            sum += node.data;
+        }
+        return sum;
+    }
+    static uint64_t clone(const container &c)
+    {
+        container copy(c);
+        return copy.count();
+    }
+};
+
+struct MapAdapter
+{
+    typedef map<int, int> container;
+    static const char *name() { return "std::map"; }
+    static void insert(container &c, int key) { c.insert(make_pair(key, key)); }
+    static bool lookup(const container &c, int key) { return c.find(key) != c.end(); }
+    static void remove(container &c, int key) { c.erase(key); }
+    static uint64_t iterate(const container &c)
+    {
+        uint64_t sum = 0;
+        for (const auto &item : c)
+        {
+            sum += item.second;
+        }
+        return sum;
+    }
+    static uint64_t clone(const container &c)
+    {
+        container copy(c);
+        return copy.size();
+    }
+};
+
+struct SetAdapter
+{
+    typedef set<int> container;
+    static const char *name() { return "std::set"; }
+    static void insert(container &c, int key) { c.insert(key); }
+    static bool lookup(const container &c, int key) { return c.find(key) != c.end(); }
+    static void remove(container &c, int key) { c.erase(key); }
+    static uint64_t iterate(const container &c)
+    {
+        uint64_t sum = 0;
+        for (const auto &item : c)
+        {
+            sum += item;
+        }
+        return sum;
+    }
+    static uint64_t clone(const container &c)
+    {
+        container copy(c);
+        return copy.size();
+    }
+};
+
+struct Options
+{
+    size_t min_size = 1000;
+    size_t max_size = 1000000;
+    bool json = false;
+    vector<string> containers = {"avl", "avl_lean", "std::map", "std::set"};
+    vector<string> workloads = {"sequential", "uniform", "zipf", "mixed"};
+    vector<string> ops = {"insert", "lookup", "remove", "iterate", "clone"};
+
+    bool has(const vector<string> &list, const string &item) const
+    {
+        return find(list.begin(), list.end(), item) != list.end();
+    }
+};
+
+/**
+ * @brief operation keys of a single workload
+ *
+ * mixed workload ops are kept in "kinds" next to their keys: 0 - lookup, 1 - insert, 2 - remove
+ */
+struct Workload
+{
+    string name;
+    vector<int> build;
+    vector<int> ops;
+    vector<unsigned char> kinds;
+};
+
+struct Measurement
+{
+    uint64_t ops = 0;
+    uint64_t total_ns = 0;
+    vector<uint32_t> samples;
+};
+
+static uint64_t _clock_overhead_ns = 0;
+
+inline uint64_t elapsed_ns(bench_clock::time_point start)
+{
+    return duration_cast<nanoseconds>(bench_clock::now() - start).count();
+}
+
+static void calibrate_clock()
+{
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 1000; i++)
+    {
+        const auto start = bench_clock::now();
+        best = min(best, elapsed_ns(start));
+    }
+    _clock_overhead_ns = best;
+}
+
+inline void sample(Measurement &m, bench_clock::time_point start)
+{
+    const uint64_t ns = elapsed_ns(start);
+    m.samples.push_back(uint32_t(min<uint64_t>(UINT32_MAX, ns > _clock_overhead_ns ? ns - _clock_overhead_ns : 0)));
+}
+
+inline size_t stride_of(size_t ops)
+{
+    return max<size_t>(1, ops / _MAX_SAMPLES);
+}
+
+inline size_t rounds_of(size_t size)
+{
+    return max<size_t>(1, _MIN_OPS / max<size_t>(1, size));
+}
+
+static Workload make_workload(const string &name, size_t size, mt19937_64 &rng)
+{
+    Workload w;
+    w.name = name;
+    w.build.resize(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        w.build[i] = int(i);
+    }
+    if (name != "sequential")
+    {
+        shuffle(w.build.begin(), w.build.end(), rng);
+    }
+
+    w.ops.resize(size);
+    if (name == "sequential")
+    {
+        w.ops = w.build;
+    }
+    else if (name == "uniform")
+    {
+        uniform_int_distribution<int> dist(0, int(size) - 1);
+        for (auto &key : w.ops)
+        {
+            key = dist(rng);
+        }
+    }
+    else if (name == "zipf")
+    {
+        // ranks are mapped through the shuffled build order so hot keys are spread over the tree
+        Zipf zipf(size, _ZIPF_THETA, rng());
+        for (auto &key : w.ops)
+        {
+            key = w.build[zipf()];
+        }
+    }
+    else if (name == "mixed")
+    {
+        // keys span twice the built range so inserts and removes both hit and miss
+        uniform_int_distribution<int> dist(0, int(size) * 2 - 1);
+        uniform_int_distribution<int> pct(0, 99);
+        w.kinds.resize(size);
+        for (size_t i = 0; i < size; i++)
+        {
+            const int p = pct(rng);
+            w.kinds[i] = p < _MIXED_READS ? 0 : (p < _MIXED_READS + (100 - _MIXED_READS) / 2 ? 1 : 2);
+            w.ops[i] = dist(rng);
+        }
+    }
+    return w;
+}
+
+template <class Adapter>
+static void build(typename Adapter::container &c, const vector<int> &keys)
+{
+    for (const auto key : keys)
+    {
+        Adapter::insert(c, key);
+    }
+}
+
+template <class Adapter>
+static Measurement bench_insert(const Workload &w)
+{
+    Measurement m;
+    const auto rounds = rounds_of(w.build.size());
+    for (size_t r = 0; r < rounds; r++)
+    {
+        typename Adapter::container c;
+        const auto start = bench_clock::now();
+        build<Adapter>(c, w.build);
+        m.total_ns += elapsed_ns(start);
+        m.ops += w.build.size();
+    }
+
+    typename Adapter::container c;
+    const auto stride = stride_of(w.build.size());
+    for (size_t i = 0; i < w.build.size(); i++)
+    {
+        if (i % stride == 0)
+        {
+            const auto start = bench_clock::now();
+            Adapter::insert(c, w.build[i]);
+            sample(m, start);
+        }
+        else
+        {
+            Adapter::insert(c, w.build[i]);
+        }
+    }
+    return m;
+}
+
+template <class Adapter>
+static Measurement bench_lookup(const Workload &w)
+{
+    Measurement m;
+    typename Adapter::container c;
+    build<Adapter>(c, w.build);
+
+    uint64_t found = 0;
+    const auto rounds = rounds_of(w.ops.size());
+    for (size_t r = 0; r < rounds; r++)
+    {
+        const auto start = bench_clock::now();
+        for (const auto key : w.ops)
+        {
+            found += Adapter::lookup(c, key);
+        }
+        m.total_ns += elapsed_ns(start);
+        m.ops += w.ops.size();
+    }
+
+    const auto stride = stride_of(w.ops.size());
+    for (size_t i = 0; i < w.ops.size(); i += stride)
+    {
+        const auto start = bench_clock::now();
+        found += Adapter::lookup(c, w.ops[i]);
+        sample(m, start);
+    }
+    _sink = found;
+    return m;
+}
+
+template <class Adapter>
+static Measurement bench_remove(const Workload &w)
+{
+    Measurement m;
+    const auto rounds = rounds_of(w.ops.size());
+    for (size_t r = 0; r < rounds; r++)
+    {
+        typename Adapter::container c;
+        build<Adapter>(c, w.build);
+        const auto start = bench_clock::now();
+        for (const auto key : w.ops)
+        {
+            Adapter::remove(c, key);
+        }
+        m.total_ns += elapsed_ns(start);
+        m.ops += w.ops.size();
+    }
+
+    typename Adapter::container c;
+    build<Adapter>(c, w.build);
+    const auto stride = stride_of(w.ops.size());
+    for (size_t i = 0; i < w.ops.size(); i++)
+    {
+        if (i % stride == 0)
+        {
+            const auto start = bench_clock::now();
+            Adapter::remove(c, w.ops[i]);
+            sample(m, start);
+        }
+        else
+        {
+            Adapter::remove(c, w.ops[i]);
+        }
+    }
+    return m;
+}
+
+template <class Adapter>
+static Measurement bench_iterate(const Workload &w)
+{
+    Measurement m;
+    typename Adapter::container c;
+    build<Adapter>(c, w.build);
+
+    uint64_t sum = 0;
+    const auto rounds = max<size_t>(3, rounds_of(w.build.size()));
+    for (size_t r = 0; r < rounds; r++)
+    {
+        const auto start = bench_clock::now();
+        sum += Adapter::iterate(c);
+        const auto ns = elapsed_ns(start);
+        m.total_ns += ns;
+        m.ops += w.build.size();
+        // a sample is the per-element cost of a full scan
+        m.samples.push_back(uint32_t(ns / max<size_t>(1, w.build.size())));
+    }
+    _sink = sum;
+    return m;
+}
+
+template <class Adapter>
+static Measurement bench_clone(const Workload &w)
+{
+    Measurement m;
+    typename Adapter::container c;
+    build<Adapter>(c, w.build);
+
+    uint64_t count = 0;
+    const auto rounds = max<size_t>(3, rounds_of(w.build.size()));
+    for (size_t r = 0; r < rounds; r++)
+    {
+        const auto start = bench_clock::now();
+        count += Adapter::clone(c);
+        const auto ns = elapsed_ns(start);
+        m.total_ns += ns;
+        m.ops += w.build.size();
+        m.samples.push_back(uint32_t(ns / max<size_t>(1, w.build.size())));
+    }
+    _sink = count;
+    return m;
+}
+
+template <class Adapter>
+static Measurement bench_mixed(const Workload &w)
+{
+    Measurement m;
+    uint64_t found = 0;
+    const auto rounds = rounds_of(w.ops.size());
+    for (size_t r = 0; r < rounds; r++)
+    {
+        typename Adapter::container c;
+        build<Adapter>(c, w.build);
+        const auto start = bench_clock::now();
+        for (size_t i = 0; i < w.ops.size(); i++)
+        {
+            const int key = w.ops[i];
+            switch (w.kinds[i])
+            {
+            case 0:
+                found += Adapter::lookup(c, key);
+                break;
+            case 1:
+                Adapter::insert(c, key);
+                break;
+            default:
+                Adapter::remove(c, key);
+                break;
+            }
+        }
+        m.total_ns += elapsed_ns(start);
+        m.ops += w.ops.size();
+    }
+
+    typename Adapter::container c;
+    build<Adapter>(c, w.build);
+    const auto stride = stride_of(w.ops.size());
+    for (size_t i = 0; i < w.ops.size(); i++)
+    {
+        const int key = w.ops[i];
+        const auto start = bench_clock::now();
+        switch (w.kinds[i])
+        {
+        case 0:
+            found += Adapter::lookup(c, key);
+            break;
+        case 1:
+            Adapter::insert(c, key);
+            break;
+        default:
+            Adapter::remove(c, key);
+            break;
+        }
+        if (i % stride == 0)
+        {
+            sample(m, start);
+        }
+    }
+    _sink = found;
+    return m;
+}
+
+static uint32_t percentile(const vector<uint32_t> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    const size_t index = min(sorted.size() - 1, size_t(p * double(sorted.size())));
+    return sorted[index];
+}
+
+static void report(const Options &options, const char *container, const Workload &w, const char *op, Measurement &m)
+{
+    sort(m.samples.begin(), m.samples.end());
+    const double ns_per_op = m.ops ? double(m.total_ns) / double(m.ops) : 0;
+    const double mops = ns_per_op > 0 ? 1000.0 / ns_per_op : 0;
+    const auto p50 = percentile(m.samples, 0.50);
+    const auto p90 = percentile(m.samples, 0.90);
+    const auto p99 = percentile(m.samples, 0.99);
+    const auto p999 = percentile(m.samples, 0.999);
+    const auto max_ns = m.samples.empty() ? 0 : m.samples.back();
+
+    if (options.json)
+    {
+        cout << "{\"container\":\"" << container << "\",\"workload\":\"" << w.name << "\",\"op\":\"" << op
+             << "\",\"size\":" << w.build.size() << ",\"ops\":" << m.ops << ",\"ns_per_op\":" << ns_per_op
+             << ",\"mops_per_s\":" << mops << ",\"p50_ns\":" << p50 << ",\"p90_ns\":" << p90 << ",\"p99_ns\":" << p99
+             << ",\"p999_ns\":" << p999 << ",\"max_ns\":" << max_ns << "}" << endl;
+    }
+    else
+    {
+        cout << container << "," << w.name << "," << op << "," << w.build.size() << "," << m.ops << "," << ns_per_op << ","
+             << mops << "," << p50 << "," << p90 << "," << p99 << "," << p999 << "," << max_ns << endl;
+    }
+}
+
+template <class Adapter>
+static void run(const Options &options, const Workload &w)
+{
+    if (!options.has(options.containers, Adapter::name()))
+    {
+        return;
+    }
+
+    Measurement m;
+    if (w.name == "mixed")
+    {
+        // a mixed workload is a single read/write stream, reported as its own operation
+        m = bench_mixed<Adapter>(w);
+        report(options, Adapter::name(), w, "mixed", m);
+        return;
+    }
+    if (options.has(options.ops, "insert"))
+    {
+        m = bench_insert<Adapter>(w);
+        report(options, Adapter::name(), w, "insert", m);
+    }
+    if (options.has(options.ops, "lookup"))
+    {
+        m = bench_lookup<Adapter>(w);
+        report(options, Adapter::name(), w, "lookup", m);
+    }
+    if (options.has(options.ops, "remove"))
+    {
+        m = bench_remove<Adapter>(w);
+        report(options, Adapter::name(), w, "remove", m);
+    }
+    if (options.has(options.ops, "iterate"))
+    {
+        m = bench_iterate<Adapter>(w);
+        report(options, Adapter::name(), w, "iterate", m);
+    }
+    if (options.has(options.ops, "clone"))
+    {
+        m = bench_clone<Adapter>(w);
+        report(options, Adapter::name(), w, "clone", m);
+    }
+}
+
+static vector<string> split(const char *list)
+{
+    vector<string> items;
+    string item;
+    for (const char *c = list;; c++)
+    {
+        if (!*c || *c == ',')
+        {
+            if (!item.empty())
+            {
+                items.push_back(item);
+            }
+            item.clear();
+            if (!*c)
+            {
+                break;
+            }
+        }
+        else
+        {
+            item += *c;
+        }
+    }
+    return items;
+}
+
+static bool parse(int argc, const char **argv, Options &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--json"))
+        {
+            options.json = true;
+        }
+        else if (!strcmp(argv[i], "--min") && has_value)
+        {
+            options.min_size = strtoull(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--max") && has_value)
+        {
+            options.max_size = strtoull(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--containers") && has_value)
+        {
+            options.containers = split(argv[++i]);
+            for (auto &name : options.containers)
+            {
+                if (name == "map" || name == "set")
+                {
+                    name = "std::" + name;
+                }
+            }
+        }
+        else if (!strcmp(argv[i], "--workloads") && has_value)
+        {
+            options.workloads = split(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--ops") && has_value)
+        {
+            options.ops = split(argv[++i]);
+        }
+        else
+        {
+            cerr << "usage: " << argv[0] << " [--min N] [--max N] [--json] [--containers avl,avl_lean,map,set]"
+                 << " [--workloads sequential,uniform,zipf,mixed] [--ops insert,lookup,remove,iterate,clone]" << endl;
+            return false;
+        }
+    }
+    return options.min_size > 0 && options.min_size <= options.max_size && options.max_size < (1u << 29);
+}
+
+int main(int argc, const char **argv)
+{
+    Options options;
+    if (!parse(argc, argv, options))
+    {
+        return 1;
+    }
+
+    calibrate_clock();
+    if (!options.json)
+    {
+        cout << "container,workload,op,size,ops,ns_per_op,mops_per_s,p50_ns,p90_ns,p99_ns,p999_ns,max_ns" << endl;
+    }
+
+    mt19937_64 rng(0x5eed);
+    for (size_t size = options.min_size; size <= options.max_size; size *= 10)
+    {
+        for (const auto &name : options.workloads)
+        {
+            const Workload w = make_workload(name, size, rng);
+            run<AvlAdapter>(options, w);
+            run<AvlLeanAdapter>(options, w);
+            run<MapAdapter>(options, w);
+            run<SetAdapter>(options, w);
+        }
+    }
+
+    return 0;
+}
@@ -4,9 +4,26 @@
  * @brief Basic test for AVL library
  * @date 2022-08-31
  *
- */#include <chrono>
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <deque>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
 
+#include "avl_cache.h"
+#include "avl_interval.h"
+#include "avl_lean.h"
+#include "avl_multi.h"
+#include "avl_quantile.h"
+#include "avl_static.h"
 #include "avl_tool.h"
 
 using namespace std;
@@ -65,6 +82,101 @@ std::ostream &operator<<(std::ostream &os, const TestData &data)
 
 static TestTree tree;
 
+/**
+ * @brief check order, parent links, heights and balance of a subtree
+ *
+ * @return int subtree height, -1 when invalid
+ */
+template <class Node>
+int valid_subtree(const Node *node, const Node *parent)
+{
+    if (!node)
+    {
+        return 0;
+    }
+    if (node->parent() != parent ||
+        (node->left() && !(node->left()->key() < node->key())) ||
+        (node->right() && !(node->key() < node->right()->key())))
+    {
+        return -1;
+    }
+    const int left = valid_subtree(node->left(), node);
+    const int right = valid_subtree(node->right(), node);
+    if (left < 0 || right < 0 || left - right > 1 || right - left > 1 || node->height() != 1 + std::max(left, right))
+    {
+        return -1;
+    }
+    return node->height();
+}
+
+template <class Tree>
+bool valid(const Tree &tree)
+{
+    return valid_subtree<typename Tree::node_type>(tree.root(), NULL) >= 0;
+}
+
+/**
+ * @brief check order, parent links and the red-black invariant of a subtree
+ *
+ * @return int subtree black height, -1 when invalid
+ */
+template <class Node>
+int valid_rb_subtree(const Node *node, const Node *parent)
+{
+    if (!node)
+    {
+        return 0;
+    }
+    if (node->parent() != parent ||
+        (node->left() && !(node->left()->key() < node->key())) ||
+        (node->right() && !(node->key() < node->right()->key())) ||
+        (node->rank() && ((node->left() && node->left()->rank()) || (node->right() && node->right()->rank()))))
+    {
+        return -1;
+    }
+    const int left = valid_rb_subtree(node->left(), node);
+    const int right = valid_rb_subtree(node->right(), node);
+    if (left < 0 || left != right)
+    {
+        return -1;
+    }
+    return left + !node->rank();
+}
+
+/**
+ * @brief check order, parent links and the weak AVL rank rule of a subtree
+ *
+ * @return int subtree rank, -1 for a missing node and -2 when invalid
+ */
+template <class Node>
+int valid_wavl_subtree(const Node *node, const Node *parent)
+{
+    if (!node)
+    {
+        return -1;
+    }
+    if (node->parent() != parent ||
+        (node->left() && !(node->left()->key() < node->key())) ||
+        (node->right() && !(node->key() < node->right()->key())) ||
+        (!node->left() && !node->right() && node->rank()))
+    {
+        return -2;
+    }
+    const int left = valid_wavl_subtree(node->left(), node);
+    const int right = valid_wavl_subtree(node->right(), node);
+    if (left < -1 || right < -1 ||
+        node->rank() - left < 1 || node->rank() - left > 2 ||
+        node->rank() - right < 1 || node->rank() - right > 2)
+    {
+        return -2;
+    }
+    return node->rank();
+}
+
+typedef AvlTree<int, int, avl::no_augment, avl::rb_balance> RbTree;
+typedef AvlTree<int, int, avl::no_augment, avl::wavl_balance> WavlTree;
+typedef AvlTree<int, int, avl::sum_augment<int>, avl::rb_balance> RbSumTree;
+
 TEST(avl_populate,
      {
          srand(time(NULL));
@@ -107,6 +219,1262 @@ TEST(avl_value_manipulation,
          TEST_ASSERT(tree == tree1, "value removed");
      })
 
+#ifdef AVL_TELEMETRY
+TEST(avl_telemetry,
+     {
+         AvlTree<int> tree1;
+         for (int key = 1; key <= 100; key++)
+         {
+             tree1.insert(key, key);
+         }
+         const AvlTelemetry &telemetry = tree1.telemetry();
+         TEST_ASSERT(telemetry.operations[AvlTelemetry::op_insert] == 100, "inserts counted");
+         TEST_ASSERT(telemetry.allocations == 100, "allocations counted");
+         TEST_ASSERT(telemetry.rotations_left[AvlTelemetry::op_insert] > 0, "ascending inserts rotate left");
+         TEST_ASSERT(telemetry.rotations_right[AvlTelemetry::op_insert] == 0, "ascending inserts never rotate right");
+
+         tree1.lookup(50);
+         TEST_ASSERT(telemetry.operations[AvlTelemetry::op_lookup] == 1, "lookup counted");
+         TEST_ASSERT(telemetry.comparisons[AvlTelemetry::op_lookup] <= (AvlTelemetry::counter)tree1.height(), "lookup bound by height");
+
+         tree1.remove(50);
+         TEST_ASSERT(telemetry.frees == 1, "free counted");
+         TEST_ASSERT(telemetry.max_retrace_depth <= (AvlTelemetry::counter)tree1.height() + 1, "retrace bound by height");
+
+         AvlTelemetry::counter latencies = 0;
+         for (int bucket = 0; bucket < AvlTelemetry::latency_buckets; bucket++)
+         {
+             latencies += telemetry.latency[AvlTelemetry::op_insert][bucket];
+         }
+         TEST_ASSERT(latencies == 100, "insert latencies recorded");
+
+         std::stringstream ss;
+         ss << avl_prometheus << tree1;
+         TEST_ASSERT(ss.str().find("# TYPE avl_latency_ns histogram") != std::string::npos, "prometheus histogram");
+         TEST_ASSERT(ss.str().find("avl_latency_ns_count{op=\"insert\"} 100") != std::string::npos, "prometheus insert count");
+
+         tree1.clear();
+         TEST_ASSERT(telemetry.frees == 100, "clear frees counted");
+         TEST_ASSERT(tree1.empty(), "clear resets count");
+
+         AvlTree<int> tree2;
+         for (int key = 0; key < 20000; key++)
+         {
+             tree2.insert(key * 2, key);
+         }
+         std::vector<int> keys;
+         for (int key = 30000; key < 31000; key++)
+         {
+             keys.push_back(key);
+         }
+         tree2.reset_telemetry();
+         tree2.lookup_sorted(keys);
+         const AvlTelemetry::counter finger_comparisons = tree2.telemetry().comparisons[AvlTelemetry::op_lookup];
+         tree2.reset_telemetry();
+         for (size_t i = 0; i < keys.size(); i++)
+         {
+             tree2.lookup(keys[i]);
+         }
+         TEST_ASSERT(finger_comparisons * 2 < tree2.telemetry().comparisons[AvlTelemetry::op_lookup], "local lookups climb less");
+     })
+#else
+TEST(avl_telemetry,
+     {
+         AvlTree<int> tree1;
+         tree1.insert(1, 1);
+         std::stringstream ss;
+         ss << avl_prometheus << tree1;
+         TEST_ASSERT(ss.str().find("telemetry is disabled") != std::string::npos, "prometheus without telemetry");
+     })
+#endif
+
+/**
+ * @brief in order concatenation of keys, associative but not commutative
+ */
+struct ConcatAugment
+{
+    typedef std::string value_type;
+    static value_type identity() { return value_type(); }
+    static value_type lift(int key, const int &) { return std::to_string(key) + " "; }
+    static value_type combine(const value_type &left, const value_type &right) { return left + right; }
+};
+
+typedef AvlTree<int, int, avl::sum_augment<int>> SumTree;
+typedef AvlTree<int, int, avl::max_augment<int>> MaxTree;
+typedef AvlTree<int, int, ConcatAugment> ConcatTree;
+
+TEST(avl_aggregate,
+     {
+         SumTree sums;
+         MaxTree maxs;
+         ConcatTree concat;
+         for (int i = 0; i < 200; i++)
+         {
+             const int key = rand() % 300;
+             sums.insert(key, key % 7);
+             maxs.insert(key, key % 7);
+             concat.insert(key, 0);
+         }
+         for (int i = 0; i < 100; i++)
+         {
+             const int key = rand() % 300;
+             sums.remove(key);
+             maxs.remove(key);
+             concat.remove(key);
+         }
+
+         for (int i = 0; i < 100; i++)
+         {
+             const int lo = rand() % 320 - 10;
+             const int hi = lo + rand() % 100;
+             int sum = 0;
+             int max = std::numeric_limits<int>::lowest();
+             std::string keys;
+             for (const SumTree::node_type *node = sums.min_left(); node; node = node->next())
+             {
+                 if (node->key() >= lo && node->key() <= hi)
+                 {
+                     sum += node->data;
+                     max = std::max(max, node->data);
+                     keys += std::to_string(node->key()) + " ";
+                 }
+             }
+             TEST_ASSERT(sums.aggregate(lo, hi) == sum, "range sum [" << lo << "," << hi << "]");
+             TEST_ASSERT(maxs.aggregate(lo, hi) == max, "range max [" << lo << "," << hi << "]");
+             TEST_ASSERT(concat.aggregate(lo, hi) == keys, "range in key order [" << lo << "," << hi << "]");
+         }
+         if (!result)
+         {
+             break;
+         }
+
+         TEST_ASSERT(sums.aggregate(10, 0) == 0, "empty range");
+         const int min = std::numeric_limits<int>::min();
+         const int max = std::numeric_limits<int>::max();
+         TEST_ASSERT(sums.aggregate() == sums.aggregate(min, max), "whole tree");
+
+         ConcatTree copy(concat);
+         TEST_ASSERT(copy.aggregate() == concat.aggregate(), "copy keeps aggregates");
+     })
+
+TEST(avl_interval,
+     {
+         AvlIntervalTree<int> intervals;
+         std::vector<AvlInterval<int>> all;
+         for (int i = 0; i < 300; i++)
+         {
+             const int start = rand() % 200;
+             const int end = start + rand() % 30;
+             intervals.insert(start, end, i);
+             all.push_back({start, end, i});
+         }
+         TEST_ASSERT(!intervals.insert(5, 4), "reversed interval rejected");
+         for (int i = 0; i < 100; i++)
+         {
+             const size_t index = rand() % all.size();
+             TEST_ASSERT(intervals.remove(all[index].start, all[index].end), "interval removed");
+             // remove drops one of the equal intervals, forget the first equal one
+             for (size_t j = 0; j < all.size(); j++)
+             {
+                 if (all[j].start == all[index].start && all[j].end == all[index].end)
+                 {
+                     all.erase(all.begin() + j);
+                     break;
+                 }
+             }
+         }
+         TEST_ASSERT(intervals.count() == (int)all.size(), "interval count");
+         TEST_ASSERT(!intervals.remove(500, 501), "missing interval");
+
+         for (int i = 0; i < 100; i++)
+         {
+             const int lo = rand() % 240 - 20;
+             const int hi = lo + rand() % 20;
+             size_t expected = 0;
+             for (const auto &interval : all)
+             {
+                 expected += interval.start <= hi && interval.end >= lo;
+             }
+             const std::vector<AvlInterval<int>> found = intervals.overlapping(lo, hi);
+             TEST_ASSERT(found.size() == expected, "overlap count [" << lo << "," << hi << "]");
+             for (size_t j = 0; j < found.size(); j++)
+             {
+                 TEST_ASSERT(found[j].start <= hi && found[j].end >= lo, "overlapping interval");
+                 TEST_ASSERT(!j || found[j - 1].start <= found[j].start, "ascending start");
+             }
+             if (!result)
+             {
+                 break;
+             }
+
+             size_t stabbed = 0;
+             for (const auto &interval : all)
+             {
+                 stabbed += interval.start <= lo && interval.end >= lo;
+             }
+             TEST_ASSERT(intervals.stabbing(lo).size() == stabbed, "stabbing count " << lo);
+         }
+     })
+
+TEST(avl_multiset,
+     {
+         AvlMultiSet<> set;
+         set.insert(5);
+         set.insert(5);
+         set.insert(7, 3);
+         TEST_ASSERT(set.size() == 5, "instances counted");
+         TEST_ASSERT(set.distinct() == 2, "one node per key");
+         TEST_ASSERT(set.count(5) == 2 && set.count(7) == 3 && set.count(6) == 0, "multiplicity");
+
+         const auto range = set.equal_range(5);
+         TEST_ASSERT(range.first && range.first->key() == 5 && range.second && range.second->key() == 7, "equal range");
+
+         TEST_ASSERT(set.remove(5) && set.count(5) == 1 && set.distinct() == 2, "remove one instance");
+         TEST_ASSERT(set.remove(5) && set.count(5) == 0 && set.distinct() == 1, "remove last instance");
+         TEST_ASSERT(!set.remove(5), "missing key");
+         TEST_ASSERT(set.remove_all(7) == 3 && set.empty(), "remove all instances");
+
+         TEST_ASSERT(!set.insert(9, 0) && set.empty() && set.distinct() == 0, "no copies of a missing key");
+         TEST_ASSERT(set.insert(9) && set.insert(9, 0) == set.equal_range(9).first && set.count(9) == 1, "no copies of an existing key");
+         TEST_ASSERT(set.remove(9) && !set.remove(9) && set.empty() && set.distinct() == 0, "no empty node left");
+     })
+
+TEST(avl_multimap,
+     {
+         AvlMultiMap<int> map;
+         for (int i = 0; i < 10; i++)
+         {
+             map.insert(i % 3, i);
+         }
+         TEST_ASSERT(map.size() == 10 && map.distinct() == 3, "one node per key");
+         TEST_ASSERT(map.count(0) == 4 && map.count(1) == 3 && map.count(3) == 0, "count");
+
+         int expected = 0;
+         const auto range = map.equal_range(0);
+         for (auto it = range.first; it != range.second; ++it)
+         {
+             TEST_ASSERT(*it == expected, "insertion order");
+             expected += 3;
+         }
+         TEST_ASSERT(expected == 12, "all values visited");
+         const auto missing = map.equal_range(5);
+         TEST_ASSERT(missing.first == missing.second, "empty range");
+
+         int removed;
+         TEST_ASSERT(map.remove(0, &removed) && removed == 9 && map.count(0) == 3, "remove last value");
+         TEST_ASSERT(map.remove_all(1) == 3 && map.distinct() == 2 && map.size() == 6, "remove all values");
+         TEST_ASSERT(map.remove(2, &removed) && map.remove(2) && map.remove(2, &removed) && removed == 2, "remove down to first value");
+         TEST_ASSERT(map.count(2) == 0 && map.distinct() == 1, "key node removed");
+     })
+
+typedef AvlTree<int, int64_t> Int64Tree;
+typedef AvlTreeTool<int, int64_t> Int64TreeTool;
+typedef AvlTree<int, uint64_t> UInt64Tree;
+typedef AvlTree<int, std::string> StringTree;
+typedef AvlTreeTool<int, std::string> StringTreeTool;
+
+TEST(avl_wide_keys,
+     {
+         Int64Tree signed_tree;
+         const int64_t base = INT64_C(1) << 40;
+         for (int i = -50; i < 50; i++)
+         {
+             signed_tree.insert(base * i, i);
+         }
+         TEST_ASSERT(signed_tree.count() == 100, "64-bit keys are distinct");
+         TEST_ASSERT(signed_tree.min_key() == base * -50 && signed_tree.max_key() == base * 49, "64-bit min and max");
+         TEST_ASSERT(signed_tree.lookup(base * 7) && signed_tree.lookup(base * 7)->data == 7, "64-bit lookup");
+         TEST_ASSERT(!signed_tree.lookup(7), "truncated key not found");
+         TEST_ASSERT(signed_tree.remove(base * -50) && signed_tree.min_key() == base * -49, "64-bit remove");
+
+         UInt64Tree unsigned_tree;
+         unsigned_tree.insert(UINT64_MAX, 1);
+         unsigned_tree.insert(0, 2);
+         unsigned_tree.insert(UINT64_MAX / 2, 3);
+         TEST_ASSERT(unsigned_tree.min_key() == 0 && unsigned_tree.max_key() == UINT64_MAX, "unsigned extremes");
+         TEST_ASSERT(unsigned_tree.lookup(UINT64_MAX)->data == 1, "unsigned max lookup");
+
+         StringTree strings;
+         strings.insert("pear", 1);
+         strings.insert("apple", 2);
+         strings.insert("zucchini", 3);
+         TEST_ASSERT(strings.min_left()->key() == "apple" && strings.max_key() == "zucchini", "generic keys use operator<");
+         TEST_ASSERT(strings.lookup("pear")->data == 1 && !strings.lookup("plum"), "generic lookup");
+     })
+
+TEST(avl_lazy_remove,
+     {
+         SumTree lazy;
+         for (int key = 0; key < 1000; key++)
+         {
+             lazy.insert(key, 1);
+         }
+         lazy.set_lazy_remove(0.5);
+         const int height = lazy.height();
+
+         for (int key = 0; key < 400; key += 2)
+         {
+             TEST_ASSERT(lazy.remove(key), "lazy remove " << key);
+         }
+         TEST_ASSERT(!lazy.remove(0), "tombstone removed twice");
+         TEST_ASSERT(lazy.count() == 800 && lazy.tombstones() == 200, "tombstones counted");
+         TEST_ASSERT(lazy.height() == height, "no rotations");
+         TEST_ASSERT(!lazy.lookup(10) && lazy.lookup(11), "lookup skips tombstones");
+         TEST_ASSERT(lazy.min_key() == 1 && lazy.min_left()->key() == 1, "min skips tombstones");
+         TEST_ASSERT(lazy.aggregate() == 800 && lazy.aggregate(0, 9) == 5, "aggregates skip tombstones");
+
+         int visited = 0;
+         for (const SumTree::node_type *node = lazy.min_left(); node; node = node->next())
+         {
+             TEST_ASSERT(!node->tombstone(), "iteration skips tombstones");
+             visited++;
+         }
+         TEST_ASSERT(visited == 800, "iteration count");
+
+         TEST_ASSERT(lazy.insert(10, 1)->key() == 10 && lazy.lookup(10), "insert revives tombstone");
+         TEST_ASSERT(lazy.count() == 801 && lazy.tombstones() == 199, "revived node counted");
+
+         SumTree copy(lazy);
+         TEST_ASSERT(copy == lazy && copy.tombstones() == 199, "copy keeps tombstones");
+
+         SumTree live;
+         SumTree dead;
+         for (int key = 0; key < 1000; key++)
+         {
+             if (key >= 400 || key % 2 || key == 10)
+             {
+                 live.insert(key, 1);
+             }
+             dead.insert(key, 1);
+         }
+         TEST_ASSERT(live == lazy && lazy == live, "tombstones are not compared");
+         TEST_ASSERT(dead != lazy && lazy != dead, "removed keys differ");
+         live.remove(999);
+         live.insert(10000, 1);
+         TEST_ASSERT(live != lazy && lazy != live, "live content compared");
+
+         for (int key = 999; key >= 400; key--)
+         {
+             lazy.remove(key);
+         }
+         TEST_ASSERT(lazy.count() == 201 && lazy.tombstones() < lazy.count(), "purged on compaction ratio");
+         TEST_ASSERT(lazy.max_key() == 399 && valid(lazy), "purged tree is balanced");
+
+         lazy.set_lazy_remove(0);
+         TEST_ASSERT(lazy.tombstones() == 0 && lazy.count() == 201 && valid(lazy), "purged when lazy remove is off");
+         TEST_ASSERT(lazy.remove(399) && lazy.max_key() == 397 && valid(lazy), "eager remove");
+     })
+
+TEST(avl_stable_remove,
+     {
+         AvlTree<int> stable;
+         std::vector<AvlNode<int> *> handles(500);
+         for (int key = 0; key < 500; key++)
+         {
+             handles[key] = stable.insert(key, key * 10);
+         }
+         for (int i = 0; i < 250; i++)
+         {
+             // internal nodes with two children are removed as well
+             const int key = stable.root()->key();
+             TEST_ASSERT(stable.remove(key), "remove " << key);
+             handles[key] = NULL;
+             TEST_ASSERT(valid(stable), "balanced after removing " << key);
+         }
+         for (int key = 0; key < 500; key++)
+         {
+             TEST_ASSERT(!handles[key] || stable.lookup(key) == handles[key], "node address kept for key " << key);
+             TEST_ASSERT(!handles[key] || (handles[key]->key() == key && handles[key]->data == key * 10), "node content kept for key " << key);
+         }
+     })
+
+TEST(avl_balance_policies,
+     {
+         RbTree rb;
+         WavlTree wavl;
+         RbSumTree sum;
+         std::vector<int> keys;
+         srand(7);
+         for (int i = 0; i < 2000; i++)
+         {
+             const int key = rand() % 1000;
+             if (rand() % 3)
+             {
+                 rb.insert(key, key);
+                 wavl.insert(key, key);
+                 sum.insert(key, key);
+             }
+             else
+             {
+                 TEST_ASSERT(rb.remove(key) == wavl.remove(key), "same remove result for " << key);
+                 sum.remove(key);
+             }
+             TEST_ASSERT(valid_rb_subtree(rb.root(), (const RbTree::node_type *)NULL) >= 0 && !(rb.root() && rb.root()->rank()), "red-black after " << key);
+             TEST_ASSERT(valid_wavl_subtree(wavl.root(), (const WavlTree::node_type *)NULL) >= -1, "weak AVL after " << key);
+         }
+         TEST_ASSERT(rb.count() == wavl.count() && rb.min_key() == wavl.min_key() && rb.max_key() == wavl.max_key(), "same content");
+
+         int total = 0;
+         for (const RbSumTree::node_type *node = sum.min_left(); node; node = node->next())
+         {
+             total += node->data;
+         }
+         TEST_ASSERT(sum.aggregate() == total, "aggregate kept by rotations");
+
+         rb.set_lazy_remove(0.25);
+         for (int key = 0; key < 1000; key += 2)
+         {
+             rb.remove(key);
+         }
+         rb.set_lazy_remove(0);
+         TEST_ASSERT(rb.tombstones() == 0 && valid_rb_subtree(rb.root(), (const RbTree::node_type *)NULL) >= 0, "red-black after rebuild");
+     })
+
+TEST(avl_render,
+     {
+         AvlTree<int> render;
+         for (int key = 0; key < 1000; key++)
+         {
+             render.insert(key, key);
+         }
+         std::ostringstream recursive;
+         std::ostringstream streamed;
+         AvlNodeTool<int>::preorder(recursive, render.root(), std::string());
+         AvlTreeTool<int>::render(streamed, render);
+         TEST_ASSERT(recursive.str() == streamed.str(), "same layout as the recursive preorder");
+
+         std::ostringstream shallow;
+         std::ostringstream few;
+         AvlTreeTool<int>::render(shallow, render, 3);
+         const std::string levels = shallow.str();
+         TEST_ASSERT(std::count(levels.begin(), levels.end(), '\n') == 7 + 4, "three levels and four cut subtrees");
+         AvlTreeTool<int>::render(few, render, 0, 10);
+         const std::string nodes = few.str();
+         TEST_ASSERT(std::count(nodes.begin(), nodes.end(), '\n') == 11, "ten nodes and the truncation mark");
+
+         std::ostringstream dot;
+         std::ostringstream json;
+         dot << avl_dot << render;
+         const std::string graph = dot.str();
+         size_t edges = 0;
+         for (size_t at = graph.find("->"); at != std::string::npos; at = graph.find("->", at + 2))
+         {
+             edges++;
+         }
+         TEST_ASSERT(graph.find("digraph avl {") == 0 && edges == 999, "a DOT edge per child");
+         json << avl_json << render;
+         const std::string document = json.str();
+         TEST_ASSERT(std::count(document.begin(), document.end(), '{') == 1000 &&
+                         std::count(document.begin(), document.end(), '{') == std::count(document.begin(), document.end(), '}'),
+                     "a JSON object per node");
+
+         StringTree text;
+         text.insert("say \"hi\"", 1);
+         std::ostringstream escaped;
+         StringTreeTool::json(escaped, text);
+         TEST_ASSERT(escaped.str() == "{\"key\":\"say \\\"hi\\\"\",\"data\":1,\"height\":1,\"left\":null,\"right\":null}\n", "escaped JSON string " << escaped.str());
+
+         StringTree fruits;
+         fruits.insert("pear", 1);
+         fruits.insert("apple", 20);
+         fruits.insert("fig", 300);
+         fruits.insert("banana", 4000);
+         std::ostringstream modes;
+         modes << avl_simple << fruits << avl_summary << fruits << avl_preorder << fruits << avl_inorder << fruits << avl_postorder << fruits
+               << avl_dot << fruits << avl_json << fruits << avl_stats << fruits << avl_prometheus << fruits;
+         TEST_ASSERT(modes.str().find("(apple,banana,fig,pear)") == 0 && modes.str().find("label=\"banana\"") != std::string::npos, "string keys in every mode");
+         std::ostringstream layout;
+         layout << avl_levelorder << fruits;
+         std::istringstream rows(layout.str());
+         std::string row;
+         std::getline(rows, row);
+         const size_t row_width = row.length();
+         bool aligned = row_width == 4 * (4 + 2);
+         while (std::getline(rows, row))
+         {
+             aligned = aligned && row.length() == row_width;
+         }
+         TEST_ASSERT(aligned && layout.str().find("4000") != std::string::npos, "level order columns fit the widest node " << layout.str());
+     })
+
+TEST(avl_bulk_export,
+     {
+         Int64Tree numbers;
+         numbers.insert(INT64_MIN, -1);
+         numbers.insert(0, 0);
+         numbers.insert(INT64_MAX, 1234567);
+         numbers.insert(-42, 10);
+         numbers.insert(7, -2147483647 - 1);
+         numbers.set_lazy_remove(0.9);
+         numbers.remove(0);
+         std::ostringstream csv;
+         Int64TreeTool::bulk_export(csv, numbers, avl::csv, true);
+         TEST_ASSERT(csv.str() == "key,data\n-9223372036854775808,-1\n-42,10\n7,-2147483648\n9223372036854775807,1234567\n", "csv " << csv.str());
+         std::ostringstream ndjson;
+         Int64TreeTool::bulk_export(ndjson, numbers, avl::ndjson);
+         TEST_ASSERT(ndjson.str().find("{\"key\":-42,\"data\":10}\n{\"key\":7,") != std::string::npos, "ndjson " << ndjson.str());
+
+         StringTree text;
+         text.insert("a,\"b\"", 1);
+         text.insert("c\td", 2);
+         std::ostringstream quoted;
+         StringTreeTool::bulk_export(quoted, text, avl::csv);
+         TEST_ASSERT(quoted.str() == "\"a,\"\"b\"\"\",1\n\"c\td\",2\n", "quoted csv " << quoted.str());
+         std::ostringstream tsv;
+         StringTreeTool::bulk_export(tsv, text, avl::tsv);
+         TEST_ASSERT(tsv.str() == "a,\"b\"\t1\nc\\td\t2\n", "escaped tsv " << tsv.str());
+
+         AvlTree<int> large;
+         std::ostringstream expected;
+         for (int key = -50000; key < 50000; key += 3)
+         {
+             large.insert(key, key * 2);
+             expected << key << "," << key * 2 << "\n";
+         }
+         std::ostringstream exported;
+         AvlTreeTool<int>::bulk_export(exported, large);
+         TEST_ASSERT(exported.str() == expected.str(), "blocks of a large export");
+     })
+
+TEST(avl_stats,
+     {
+         AvlTree<int> sequential;
+         for (int key = 0; key < 1000; key++)
+         {
+             sequential.insert(key, key);
+         }
+         const avl::tree_stats stats = AvlTreeTool<int>::stats(sequential);
+         size_t histogram = 0;
+         for (size_t depth = 0; depth < stats.depth.size(); depth++)
+         {
+             histogram += stats.depth[depth];
+         }
+         TEST_ASSERT(stats.nodes == 1000 && histogram == 1000 && stats.depth[0] == 1, "every node counted once");
+         TEST_ASSERT(stats.height == sequential.height() && stats.min_height == 10 && stats.max_avl_height == 14, "height bounds");
+         TEST_ASSERT(stats.height >= stats.min_height && stats.height <= stats.max_avl_height, "height within bounds");
+         TEST_ASSERT(stats.average_depth() > 7 && stats.average_depth() < 9, "average depth " << stats.average_depth());
+         TEST_ASSERT(stats.node_bytes == sizeof(AvlNode<int>) && stats.allocated_bytes >= stats.node_bytes, "node footprint");
+         TEST_ASSERT(stats.payload_bytes == 1000 * (sizeof(int) + sizeof(int)) && stats.total_bytes() == 1000 * stats.allocated_bytes, "payload footprint");
+
+         std::ostringstream report;
+         report << avl_stats << sequential;
+         TEST_ASSERT(report.str().find("nodes: 1000\n") == 0 && report.str().find("AVL bound 14") != std::string::npos, "stats manipulator");
+     })
+
+typedef AvlTree<int, int, avl::hash_augment<int>> HashTree;
+typedef AvlTree<int, int, avl::hash_augment<int>, avl::rb_balance> RbHashTree;
+
+TEST(avl_hash_diff,
+     {
+         HashTree ascending;
+         HashTree descending;
+         RbHashTree red_black;
+         for (int key = 0; key < 5000; key++)
+         {
+             ascending.insert(key * 2, key);
+             descending.insert((4999 - key) * 2, 4999 - key);
+             red_black.insert(key * 2, key);
+         }
+         TEST_ASSERT(ascending.aggregate() == descending.aggregate() && ascending.aggregate() == red_black.aggregate(), "hash ignores the tree shape");
+         TEST_ASSERT(ascending.diff(descending).empty(), "no difference");
+
+         descending.remove(100);
+         descending.insert(101, 0);
+         descending.lookup(4000)->data = -1;
+         descending.refresh(descending.lookup(4000));
+         TEST_ASSERT(ascending.aggregate() != descending.aggregate(), "hash changed");
+         std::vector<int> expected;
+         expected.push_back(100);
+         expected.push_back(101);
+         expected.push_back(4000);
+         TEST_ASSERT(ascending.diff(descending) == expected && descending.diff(ascending) == expected, "changed keys only");
+
+         descending.set_lazy_remove(0.5);
+         descending.remove(0);
+         descending.remove(9998);
+         expected.insert(expected.begin(), 0);
+         expected.push_back(9998);
+         TEST_ASSERT(ascending.diff(descending) == expected && descending.diff(ascending) == expected, "tombstones differ");
+
+         HashTree empty;
+         TEST_ASSERT(empty.diff(ascending).size() == 5000 && ascending.diff(empty).size() == 5000, "diff with an empty tree");
+     })
+
+TEST(avl_clone,
+     {
+         AvlTree<int> source;
+         for (int key = 0; key < 40000; key++)
+         {
+             source.insert((key * 7919) % 40000, key);
+         }
+         source.set_lazy_remove(0.5);
+         source.remove(5);
+         source.set_lazy_remove(0);
+         source.set_lazy_remove(0.9);
+         source.remove(6);
+
+         for (unsigned threads = 1; threads <= 4; threads += 3)
+         {
+             AvlTree<int> *inorder = source.clone(avl::inorder_layout, threads);
+             TEST_ASSERT(*inorder == source && valid(*inorder) && inorder->height() == source.height(), "inorder clone on " << threads << " threads");
+             TEST_ASSERT(inorder->tombstones() == 1 && !inorder->lookup(6) && inorder->lookup(7), "tombstones cloned");
+             const AvlNode<int> *first = inorder->min_left();
+             int position = 0;
+             for (const AvlNode<int> *node = first; node; node = node->next(), position++)
+             {
+                 // the tombstone of key 6 keeps its slot
+                 TEST_ASSERT(node == first + position + (node->key() > 6), "ascending keys in consecutive nodes");
+             }
+             AvlTree<int> *veb = source.clone(avl::veb_layout, threads);
+             TEST_ASSERT(*veb == source && valid(*veb), "van Emde Boas clone on " << threads << " threads");
+             for (int key = 0; key < 1000; key++)
+             {
+                 veb->remove(key);
+                 veb->insert(key + 40000, key);
+             }
+             // keys 5 and 6 were removed already
+             TEST_ASSERT(valid(*veb) && veb->count() == source.count() + 2, "clone updates");
+             delete inorder;
+             delete veb;
+         }
+
+         AvlTree<int> assigned;
+         assigned.insert(1, 1);
+         assigned = source;
+         TEST_ASSERT(assigned == source && valid(assigned), "assignment copies into a block");
+         assigned.clear();
+         TEST_ASSERT(assigned.empty() && assigned.insert(1, 1) && assigned.count() == 1, "cleared copy");
+     })
+
+TEST(avl_parallel,
+     {
+         SumTree values;
+         for (int key = 0; key < 100000; key++)
+         {
+             values.insert((key * 7919) % 100000, 1);
+         }
+         values.parallel_for_each([](const int &key, int &data)
+                                  { data = key % 10; },
+                                  4, 256);
+         TEST_ASSERT(values.aggregate() == 450000 && values.aggregate(0, 99) == 450 && valid(values), "aggregates recomputed after parallel visit");
+
+         const long long sum = values.parallel_reduce(0LL, [](const int &, const int &data)
+                                                      { return (long long)data; },
+                                                      [](long long a, long long b)
+                                                      { return a + b; },
+                                                      4, 256);
+         TEST_ASSERT(sum == 450000, "parallel sum " << sum);
+
+         // concatenation is not commutative, pieces must be combined in key order
+         values.set_lazy_remove(0.5);
+         for (int key = 0; key < 100000; key += 2)
+         {
+             values.remove(key);
+         }
+         const std::vector<int> keys = values.parallel_reduce(std::vector<int>(), [](const int &key, const int &)
+                                                              { return std::vector<int>(1, key); },
+                                                              [](std::vector<int> a, const std::vector<int> &b)
+                                                              {
+                                                                  a.insert(a.end(), b.begin(), b.end());
+                                                                  return a;
+                                                              },
+                                                              3, 100);
+         bool ordered = keys.size() == 50000;
+         for (size_t i = 0; ordered && i < keys.size(); i++)
+         {
+             ordered = keys[i] == int(2 * i + 1);
+         }
+         TEST_ASSERT(ordered, "ordered reduce skips tombstones");
+     })
+
+TEST(avl_quantile,
+     {
+         AvlQuantile<int> window(1000);
+         std::deque<int> recent;
+         srand(11);
+         for (int i = 0; i < 20000; i++)
+         {
+             const int sample = rand() % 500;
+             window.push(sample);
+             recent.push_back(sample);
+             if (recent.size() > 1000)
+             {
+                 recent.pop_front();
+             }
+             if (i % 997 == 0)
+             {
+                 std::vector<int> sorted(recent.begin(), recent.end());
+                 std::sort(sorted.begin(), sorted.end());
+                 TEST_ASSERT(window.size() == sorted.size(), "window size");
+                 TEST_ASSERT(window.quantile(0) == sorted.front() && window.quantile(1) == sorted.back(), "extreme quantiles");
+                 TEST_ASSERT(window.median() == sorted[(sorted.size() + 1) / 2 - 1], "median");
+                 TEST_ASSERT(window.quantile(0.99) == sorted[size_t(std::ceil(0.99 * sorted.size())) - 1], "p99");
+                 TEST_ASSERT(window.rank(250) == size_t(std::lower_bound(sorted.begin(), sorted.end(), 250) - sorted.begin()), "rank");
+             }
+         }
+         TEST_ASSERT(window.tree().count() <= 500 && valid(window.tree()), "repeats share nodes");
+
+         AvlQuantile<int> aged(0, std::chrono::seconds(10));
+         const AvlQuantile<int>::clock::time_point start;
+         for (int second = 0; second < 30; second++)
+         {
+             aged.push(second, start + std::chrono::seconds(second));
+         }
+         TEST_ASSERT(aged.size() == 11 && aged.quantile(0) == 19 && aged.median() == 24, "age eviction");
+         aged.evict(start + std::chrono::seconds(100));
+         TEST_ASSERT(aged.empty() && aged.tree().empty() && aged.median() == 0, "everything expired");
+
+         AvlQuantile<double> latency(3);
+         TEST_ASSERT(latency.push(1.0) && latency.push(2.0) && !latency.push(std::nan("")), "NaN rejected");
+         TEST_ASSERT(latency.size() == 2 && latency.tree().count() == 2 && latency.tree().aggregate() == 2, "NaN not counted");
+         TEST_ASSERT(latency.push(3.0) && latency.push(4.0) && latency.quantile(0) == 2.0 && latency.median() == 3.0, "window intact");
+     })
+
+TEST(avl_finger_lookup,
+     {
+         AvlTree<int> tree;
+         srand(43);
+         for (int i = 0; i < 20000; i++)
+         {
+             tree.insert(rand() % 40000 * 2, i);
+         }
+
+         AvlNode<int> *finger = NULL;
+         for (int i = 0; i < 2000; i++)
+         {
+             const int key = rand() % 80002 - 1;
+             AvlNode<int> *before = finger;
+             TEST_ASSERT(tree.lookup(key, finger) == tree.lookup(key) && finger, "random finger");
+             TEST_ASSERT(tree.lookup(key, before) == tree.lookup(key), "same key again");
+         }
+
+         std::vector<int> keys;
+         for (int key = 30000; key < 31000; key++)
+         {
+             keys.push_back(key);
+         }
+         std::vector<AvlNode<int> *> nodes = tree.lookup_sorted(keys);
+         bool match = nodes.size() == keys.size();
+         for (size_t i = 0; match && i < keys.size(); i++)
+         {
+             match = nodes[i] == tree.lookup(keys[i]);
+         }
+         TEST_ASSERT(match, "sorted batch");
+
+         std::reverse(keys.begin(), keys.end());
+         nodes = tree.lookup_sorted(keys);
+         TEST_ASSERT(nodes.size() == keys.size() && nodes.front() == tree.lookup(keys.front()) && nodes.back() == tree.lookup(keys.back()), "descending batch");
+
+         AvlTree<int> empty;
+         finger = NULL;
+         TEST_ASSERT(!empty.lookup(1, finger) && !finger, "empty tree");
+     })
+
+template <class Node>
+void collect_inorder(Node *node, std::vector<Node *> &nodes)
+{
+    if (node)
+    {
+        collect_inorder(node->left(), nodes);
+        if (!node->tombstone())
+        {
+            nodes.push_back(node);
+        }
+        collect_inorder(node->right(), nodes);
+    }
+}
+
+/**
+ * @brief check that next() and previous() step through the live nodes in key order
+ */
+template <class Tree>
+bool valid_steps(const Tree &tree)
+{
+    std::vector<typename Tree::node_type *> nodes;
+    collect_inorder(tree.root(), nodes);
+    typename Tree::node_type *node = tree.min_left();
+    for (size_t i = 0; i < nodes.size(); i++, node = node->next())
+    {
+        if (node != nodes[i] || node->previous() != (i ? nodes[i - 1] : NULL))
+        {
+            return false;
+        }
+    }
+    return node == NULL && tree.max_right() == (nodes.empty() ? NULL : nodes.back());
+}
+
+/**
+ * @brief every kind of tree update, checking the inorder steps after each
+ */
+template <class Tree>
+bool inorder_steps()
+{
+    Tree tree;
+    srand(44);
+    for (int round = 0; round < 20; round++)
+    {
+        for (int i = 0; i < 200; i++)
+        {
+            tree.insert(rand() % 1000, 1);
+        }
+        for (int i = 0; i < 150; i++)
+        {
+            tree.remove(rand() % 1000);
+        }
+        if (!valid(tree) || !valid_steps(tree))
+        {
+            return false;
+        }
+    }
+
+    Tree *copy = tree.clone(avl::veb_layout);
+    copy->insert(-1, 1);
+    copy->remove(copy->root()->key());
+    const bool cloned = valid_steps(*copy) && *copy != tree;
+    delete copy;
+
+    Tree assigned;
+    assigned = tree;
+    assigned.erase_range(100, 300);
+    Tree *range = assigned.extract_range(500, 600);
+    const bool ranges = valid_steps(assigned) && valid_steps(*range) && range->count() && !assigned.lookup(550);
+    delete range;
+
+    typename Tree::node_handle handle = assigned.extract(assigned.max_key());
+    const int moved = handle.key();
+    handle.set_key(-moved);
+    assigned.insert(std::move(handle));
+    assigned.compact_step(50);
+    const bool handles = valid_steps(assigned) && assigned.lookup(-moved);
+    assigned.compact();
+
+    Tree loaded;
+    std::vector<std::pair<int, int>> records;
+    for (int i = 0; i < 3000; i++)
+    {
+        records.push_back(std::make_pair(rand() % 5000, 1));
+    }
+    loaded.bulk_load(records, 2);
+    loaded.insert(-1, 1);
+
+    tree.set_lazy_remove(0.5);
+    bool lazy = true;
+    for (int i = 0; i < 1000 && tree.count() > 10; i += 3)
+    {
+        tree.remove(i);
+        lazy = lazy && valid_steps(tree);
+    }
+    tree.clear();
+    return cloned && ranges && handles && valid_steps(assigned) && valid_steps(loaded) && lazy && valid_steps(tree);
+}
+
+typedef AvlTree<int, int, avl::threaded<>> ThreadedTree;
+typedef AvlTree<int, int, avl::threaded<avl::sum_augment<int>>> ThreadedSumTree;
+
+TEST(avl_inorder_steps,
+     {
+         TEST_ASSERT(inorder_steps<AvlTree<int>>(), "parent climbing steps");
+         TEST_ASSERT(inorder_steps<ThreadedTree>(), "threaded steps");
+         TEST_ASSERT(inorder_steps<ThreadedSumTree>(), "threaded augmented steps");
+         TEST_ASSERT(sizeof(ThreadedTree::node_type) == sizeof(AvlNode<int>) + 2 * sizeof(void *), "links only in threaded nodes");
+
+         ThreadedSumTree sums;
+         for (int key = 0; key < 100; key++)
+         {
+             sums.insert(key, key);
+         }
+         sums.remove(50);
+         TEST_ASSERT(sums.aggregate() == 4900 && sums.aggregate(40, 60) == 1000 && valid_steps(sums), "threaded trees keep aggregates");
+     })
+
+/**
+ * @brief check order and the balance bits of a lean subtree
+ *
+ * @return int subtree height, -1 when invalid
+ */
+template <class Node>
+int valid_lean_subtree(const Node *node)
+{
+    if (!node)
+    {
+        return 0;
+    }
+    if ((node->left() && !(node->left()->key() < node->key())) ||
+        (node->right() && !(node->key() < node->right()->key())))
+    {
+        return -1;
+    }
+    const int left = valid_lean_subtree(node->left());
+    const int right = valid_lean_subtree(node->right());
+    if (left < 0 || right < 0 || left - right != node->balance())
+    {
+        return -1;
+    }
+    return 1 + std::max(left, right);
+}
+
+TEST(avl_lean_tree,
+     {
+         TEST_ASSERT(sizeof(AvlLeanNode<int>) < sizeof(AvlNode<int>), "lean node is smaller");
+
+         AvlLeanTree<int> lean;
+         std::set<int> expected;
+         srand(45);
+         for (int round = 0; round < 20; round++)
+         {
+             for (int i = 0; i < 500; i++)
+             {
+                 const int key = rand() % 2000;
+                 const AvlLeanNode<int> *node = lean.insert(key, key * 2);
+                 expected.insert(key);
+                 TEST_ASSERT(node->key() == key && node->data == key * 2, "insert");
+             }
+             for (int i = 0; i < 400; i++)
+             {
+                 const int key = rand() % 2000;
+                 int data = -1;
+                 TEST_ASSERT(lean.remove(key, &data) == (expected.erase(key) == 1), "remove");
+                 TEST_ASSERT(data == -1 || data == key * 2, "removed data");
+             }
+             const int height = valid_lean_subtree(lean.root());
+             TEST_ASSERT(height >= 0 && height == lean.height() && lean.count() == expected.size(), "balance bits");
+         }
+
+         std::vector<int> keys;
+         lean.for_each([&keys](const int &key, int &)
+                       { keys.push_back(key); });
+         TEST_ASSERT(keys == std::vector<int>(expected.begin(), expected.end()), "inorder walk");
+         TEST_ASSERT(lean.lookup(keys.front()) && !lean.lookup(-1), "lookup");
+
+         AvlLeanTree<int> copy(lean);
+         copy.remove(keys.front());
+         TEST_ASSERT(valid_lean_subtree(copy.root()) >= 0 && copy.count() + 1 == lean.count() && lean.lookup(keys.front()), "copy");
+         lean.clear();
+         TEST_ASSERT(lean.empty() && lean.begin() == lean.end() && !lean.height(), "clear");
+     })
+
+/**
+ * @brief erase random ranges from a tree and check it against a reference set
+ */
+template <class Tree, class Validator>
+bool erase_ranges(Tree &tree, Validator valid_tree)
+{
+    std::set<int> expected;
+    for (int i = 0; i < 3000; i++)
+    {
+        const int key = rand() % 10000;
+        tree.insert(key, key);
+        expected.insert(key);
+    }
+    for (int round = 0; round < 40; round++)
+    {
+        const int lo = rand() % 10000;
+        const int hi = lo + rand() % (round % 2 ? 50 : 2000);
+        const int removed = tree.erase_range(lo, hi);
+        const size_t before = expected.size();
+        expected.erase(expected.lower_bound(lo), expected.upper_bound(hi));
+        if (removed != int(before - expected.size()) || tree.count() != int(expected.size()) || !valid_tree(tree) ||
+            (!expected.empty() && (tree.min_key() != *expected.begin() || tree.max_key() != *expected.rbegin())) ||
+            (expected.count(lo - 1) && !tree.lookup(lo - 1)) || (expected.count(hi + 1) && !tree.lookup(hi + 1)))
+        {
+            return false;
+        }
+    }
+    return tree.erase_range(-1, 10000) == int(expected.size()) && tree.empty() && !tree.root();
+}
+
+TEST(avl_range_erase,
+     {
+         srand(46);
+         AvlTree<int> tree;
+         SumTree sums;
+         RbTree rb;
+         WavlTree wavl;
+         TEST_ASSERT(erase_ranges(tree, valid<AvlTree<int>>), "avl");
+         TEST_ASSERT(erase_ranges(sums, valid<SumTree>), "augmented");
+         TEST_ASSERT(erase_ranges(rb, [](const RbTree &t)
+                                  { return valid_rb_subtree<RbTree::node_type>(t.root(), NULL) >= 0; }),
+                     "red-black");
+         TEST_ASSERT(erase_ranges(wavl, [](const WavlTree &t)
+                                  { return valid_wavl_subtree<WavlTree::node_type>(t.root(), NULL) >= -1; }),
+                     "weak avl");
+
+         for (int key = 0; key < 1000; key++)
+         {
+             sums.insert(key, key);
+         }
+         SumTree *range = sums.extract_range(100, 199);
+         TEST_ASSERT(range->count() == 100 && valid(*range) && range->min_key() == 100 && range->max_key() == 199, "extracted range");
+         TEST_ASSERT(range->aggregate() == 14950 && sums.aggregate() == 499500 - 14950 && valid(sums) && !sums.lookup(150), "aggregates");
+         delete range;
+
+         SumTree *copy = sums.clone();
+         copy->set_lazy_remove(0.9);
+         copy->remove(500);
+         copy->remove(501);
+         range = copy->extract_range(400, 599);
+         TEST_ASSERT(range->count() == 198 && !range->lookup(500) && valid(*range) && valid_steps(*range), "copied out of a block");
+         TEST_ASSERT(copy->count() == 700 && copy->tombstones() == 0 && valid(*copy) && valid_steps(*copy), "tombstones dropped");
+         delete copy;
+         TEST_ASSERT(range->aggregate(450, 460) == 5005, "outlives the block");
+         delete range;
+     })
+
+typedef std::pair<int, int> Record;
+typedef std::map<int, int> RecordMap;
+
+TEST(avl_bulk_load,
+     {
+         std::vector<Record> records;
+         RecordMap expected;
+         srand(47);
+         for (int i = 0; i < 100000; i++)
+         {
+             const int key = rand() % 75000;
+             records.push_back(Record(key, i % 1000));
+             expected.insert(Record(key, i % 1000));
+         }
+
+         SumTree tree;
+         tree.insert(-5, 1);
+         tree.bulk_load(records, 4);
+         bool match = tree.count() == int(expected.size()) && valid(tree) && valid_steps(tree) && !tree.lookup(-5);
+         long sum = 0;
+         for (RecordMap::const_iterator it = expected.begin(); match && it != expected.end(); ++it)
+         {
+             const SumTree::node_type *node = tree.lookup(it->first);
+             match = node && node->data == it->second;
+             sum += it->second;
+         }
+         TEST_ASSERT(match && tree.aggregate() == sum, "sorted, first data of repeated keys kept");
+         TEST_ASSERT(tree.min_key() == expected.begin()->first && tree.max_key() == expected.rbegin()->first, "min and max keys");
+
+         tree.remove(tree.root()->key());
+         tree.insert(-5, 1);
+         TEST_ASSERT(valid(tree) && tree.count() == int(expected.size()), "updates after a bulk load");
+
+         RbTree rb;
+         rb.bulk_load(records, 1);
+         TEST_ASSERT(rb.count() == int(expected.size()) && valid_rb_subtree<RbTree::node_type>(rb.root(), NULL) >= 0, "single thread red-black");
+
+         std::vector<Record> few(1, Record(3, 3));
+         few.push_back(Record(1, 1));
+         few.push_back(Record(3, 4));
+         tree.bulk_load(few);
+         TEST_ASSERT(tree.count() == 2 && tree.lookup(3)->data == 3 && valid(tree), "small input");
+         tree.bulk_load(std::vector<Record>());
+         TEST_ASSERT(tree.empty() && !tree.root(), "empty input");
+     })
+
+TEST(avl_node_handle,
+     {
+         SumTree source;
+         SumTree target;
+         for (int key = 0; key < 100; key++)
+         {
+             source.insert(key, key);
+         }
+
+         for (int key = 0; key < 100; key += 2)
+         {
+             SumTree::node_type *node = source.lookup(key);
+             SumTree::node_handle handle = source.extract(key);
+             TEST_ASSERT(handle && handle.key() == key && handle.data() == key && !source.lookup(key), "extract");
+             TEST_ASSERT(target.insert(std::move(handle)) == node && handle.empty(), "same node relinked");
+         }
+         TEST_ASSERT(source.count() == 50 && target.count() == 50 && valid(source) && valid(target), "moved between trees");
+         TEST_ASSERT(source.aggregate() == 2500 && target.aggregate() == 2450 && valid_steps(source) && valid_steps(target), "aggregates");
+         TEST_ASSERT(target.min_key() == 0 && target.max_key() == 98 && source.min_key() == 1 && source.max_key() == 99, "min and max keys");
+
+         SumTree::node_type *node = target.lookup(98);
+         SumTree::node_handle handle = target.extract(98);
+         handle.set_key(-1);
+         handle.data() = 7;
+         TEST_ASSERT(target.insert(std::move(handle)) == node && node->key() == -1 && target.min_key() == -1 && target.max_key() == 96, "re-keyed");
+         TEST_ASSERT(target.aggregate(-1, -1) == 7 && valid(target), "re-keyed aggregate");
+
+         handle = target.extract(4);
+         handle.set_key(6);
+         TEST_ASSERT(target.insert(std::move(handle)) == target.lookup(6) && handle && target.count() == 49, "taken key keeps the handle");
+         TEST_ASSERT(!target.extract(5) && !target.insert(SumTree::node_handle()), "empty handles");
+
+         target.set_lazy_remove(0.9);
+         target.remove(8);
+         handle.set_key(8);
+         TEST_ASSERT(target.insert(std::move(handle)) && target.lookup(8)->data == 4 && target.tombstones() == 0 && valid(target), "replaces a tombstone");
+
+         SumTree *copy = source.clone();
+         SumTree::node_type *pooled = copy->lookup(51);
+         handle = copy->extract(51);
+         delete copy;
+         TEST_ASSERT(handle.key() == 51 && handle.data() == 51, "outlives the block owner");
+         TEST_ASSERT(target.insert(std::move(handle)) == pooled && target.aggregate(51, 51) == 51 && valid(target), "taken out of a block");
+         handle = target.extract(51);
+         target.clear();
+         handle.set_key(50);
+         TEST_ASSERT(source.insert(std::move(handle)) == pooled && source.count() == 51, "back from a cleared tree");
+
+         SumTree *range = source.extract_range(41, 61);
+         TEST_ASSERT(range->lookup(50) == pooled && range->count() == 12 && valid(*range) && valid(source), "range shares the block");
+         handle = range->extract(50);
+         delete range;
+
+         source.compact_step(10);
+         handle.set_key(0);
+         TEST_ASSERT(source.insert(std::move(handle)) && source.lookup(0)->data == 51, "linked behind a compaction cycle");
+         while (!source.compact_step(10))
+         {
+         }
+         TEST_ASSERT(source.count() == 40 && source.aggregate() == 2500 - 561 + 51 && valid(source) && valid_steps(source), "compaction cycle over");
+     })
+
+/**
+ * @brief whether all the nodes of a tree lie in a single array
+ */
+template <class Tree>
+bool contiguous(const Tree &tree)
+{
+    std::vector<typename Tree::node_type *> nodes;
+    collect_inorder(tree.root(), nodes);
+    std::sort(nodes.begin(), nodes.end());
+    return nodes.empty() || size_t(nodes.back() - nodes.front()) + 1 == nodes.size();
+}
+
+TEST(avl_compact,
+     {
+         SumTree tree;
+         std::set<int> expected;
+         srand(49);
+         for (int i = 0; i < 20000; i++)
+         {
+             const int key = rand() % 10000;
+             if (rand() % 3)
+             {
+                 tree.insert(key, key);
+                 expected.insert(key);
+             }
+             else
+             {
+                 tree.remove(key);
+                 expected.erase(key);
+             }
+         }
+         TEST_ASSERT(!contiguous(tree), "scattered by churn");
+
+         int steps = 0;
+         while (!tree.compact_step(500))
+         {
+             steps++;
+             const int key = rand() % 10000;
+             tree.insert(key, key);
+             expected.insert(key);
+             tree.remove(key + 1);
+             expected.erase(key + 1);
+             TEST_ASSERT(valid(tree), "valid between steps");
+         }
+         TEST_ASSERT(steps >= int(expected.size() / 500) - 1 && tree.count() == int(expected.size()) && valid(tree) && valid_steps(tree), "incremental cycle");
+         long sum = 0;
+         for (std::set<int>::const_iterator it = expected.begin(); it != expected.end(); ++it)
+         {
+             sum += *it;
+         }
+         TEST_ASSERT(tree.aggregate() == sum && tree.lookup(*expected.begin()) && tree.min_key() == *expected.begin(), "content kept");
+
+         while (!tree.compact_step(1000))
+         {
+         }
+         TEST_ASSERT(contiguous(tree) && valid(tree), "quiet cycle packs every node");
+
+         tree.set_lazy_remove(0.5);
+         tree.remove(*expected.begin());
+         expected.erase(expected.begin());
+         for (int key = 0; key < 100; key++)
+         {
+             tree.insert(20000 + key, 1);
+             expected.insert(20000 + key);
+         }
+         tree.compact_step(10);
+         tree.compact();
+         TEST_ASSERT(contiguous(tree) && tree.tombstones() == 0 && tree.count() == int(expected.size()) && valid(tree) && valid_steps(tree), "full compaction");
+         TEST_ASSERT(tree.compact_step(1) == false && tree.compact_step(100000), "cycle after a full compaction");
+
+         AvlTree<int> empty;
+         empty.compact();
+         TEST_ASSERT(empty.compact_step(10) && empty.empty(), "empty tree");
+     })
+
+TEST(avl_cached_tree,
+     {
+         AvlCachedTree<int> tree(256);
+         for (int key = 0; key < 100000; key++)
+         {
+             tree.insert(key, key * 3);
+         }
+
+         srand(50);
+         bool match = true;
+         for (int i = 0; i < 200000 && match; i++)
+         {
+             // a few hot keys take most of the lookups
+             const int key = rand() % 4 ? rand() % 64 * 1000 : rand() % 100000;
+             const AvlNode<int> *node = tree.lookup(key);
+             match = node && node->key() == key && node->data == key * 3;
+         }
+         TEST_ASSERT(match && tree.hits() + tree.misses() == 200000, "lookups through the cache");
+         TEST_ASSERT(tree.hits() > tree.misses() * 2, "hot keys hit");
+
+         TEST_ASSERT(tree.remove(5000) && !tree.lookup(5000) && !tree.tree().lookup(5000), "remove invalidates");
+         tree.insert(5000, 1);
+         TEST_ASSERT(tree.lookup(5000)->data == 1 && tree.lookup(5000)->data == 1, "reinserted key");
+
+         tree.reset_counters();
+         TEST_ASSERT(!tree.lookup(-1) && !tree.lookup(-1) && tree.misses() == 2 && !tree.hits(), "missing keys are not cached");
+
+         AvlCachedTree<int> copy(tree);
+         copy.remove(7000);
+         TEST_ASSERT(tree.lookup(7000) && !copy.lookup(7000) && copy.lookup(6000) == copy.tree().lookup(6000), "copies cache their own nodes");
+
+         tree.clear();
+         TEST_ASSERT(!tree.lookup(6000) && tree.empty(), "clear invalidates");
+     })
+
+#if __cplusplus >= 201703L
+constexpr auto static_codes = avl::make_static_tree<const char *>({{404, "not found"}, {200, "ok"}, {500, "error"}, {200, "again"}, {301, "moved"}});
+static_assert(static_codes.count() == 4 && static_codes.contains(301) && !static_codes.contains(302), "built at compile time");
+typedef AvlStaticTree<int, int, 1000> StaticTree;
+
+TEST(avl_static_tree,
+     {
+         TEST_ASSERT(std::string(*static_codes.lookup(200)) == "ok" && !static_codes.lookup(0) && !static_codes.lookup(600), "first data of a repeated key");
+         TEST_ASSERT(static_codes.min_key() == 200 && static_codes.max_key() == 500, "min and max keys");
+         TEST_ASSERT(static_codes.count(250, 500) == 3 && static_codes.count(500, 250) == 0, "range count");
+         std::vector<int> keys;
+         static_codes.for_each(300, 404, [&keys](const int &key, const char *const &)
+                               { keys.push_back(key); });
+         TEST_ASSERT(keys.size() == 2 && keys[0] == 301 && keys[1] == 404, "range walk");
+
+         AvlStaticEntry<int> entries[1000];
+         for (int i = 0; i < 1000; i++)
+         {
+             entries[i].key = (i * 7919) % 1000 * 2;
+             entries[i].data = i;
+         }
+         const StaticTree evens(entries);
+         for (int key = -1; key <= 2000; key++)
+         {
+             const int *data = evens.lookup(key);
+             TEST_ASSERT(key % 2 == 0 && key < 2000 ? data && (*data * 7919) % 1000 * 2 == key : !data, "lookup");
+             TEST_ASSERT(evens.lower_bound(key) - evens.begin() == (key + 1) / 2 && evens.upper_bound(key) - evens.begin() == (key < 0 ? 0 : std::min(1000, key / 2 + 1)), "bounds");
+         }
+     })
+#else
+bool avl_static_tree()
+{
+    LOG("TEST avl_static_tree SKIPPED (requires C++17, run make run TARGET=test STD=c++17)");
+    return true;
+}
+#endif
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -116,7 +1484,32 @@ extern "C"
         avl_populate,
         avl_copy_constructor,
         avl_assigment_operator,
-        avl_value_manipulation);
+        avl_value_manipulation,
+        avl_telemetry,
+        avl_aggregate,
+        avl_interval,
+        avl_multiset,
+        avl_multimap,
+        avl_wide_keys,
+        avl_lazy_remove,
+        avl_stable_remove,
+        avl_balance_policies,
+        avl_render,
+        avl_bulk_export,
+        avl_stats,
+        avl_hash_diff,
+        avl_clone,
+        avl_parallel,
+        avl_quantile,
+        avl_finger_lookup,
+        avl_inorder_steps,
+        avl_lean_tree,
+        avl_range_erase,
+        avl_bulk_load,
+        avl_node_handle,
+        avl_compact,
+        avl_cached_tree,
+        avl_static_tree);
 
 #ifdef __cplusplus
 }